@@ -138,6 +138,11 @@ HEADERS += src/CGAL_renderer.h \
            src/dxfrotextrude.h \
            src/import.h \
            src/projection.h \
+           src/offset.h \
+           src/simplify.h \
+           src/optimizer.h \
+           src/planner.h \
+           src/gmppool.h \
            src/render.h \
            src/render-opencsg.h \
            src/surface.h \
@@ -156,6 +161,11 @@ SOURCES += src/openscad.cc \
            src/transform.cc \
            src/primitives.cc \
            src/projection.cc \
+           src/offset.cc \
+           src/simplify.cc \
+           src/optimizer.cc \
+           src/planner.cc \
+           src/gmppool.cc \
            src/cgaladv.cc \
 	   src/cgaladv_convexhull2.cc \
            src/cgaladv_minkowski3.cc \
@@ -47,6 +47,7 @@ public:
 	QVector<CSGTerm*> background_terms;
 	CSGChain *background_chain;
 	QString last_compiled_doc;
+	QString csg_key;                    // Tree the CSG products were compiled from
 	bool enableOpenCSG;
 
 	static const int maxRecentFiles = 10;
@@ -73,6 +74,7 @@ private:
 	AbstractNodePtr find_root_tag(AbstractNodePtr n);
 	void compile(bool procevents);
 	void compileCSG(bool procevents);
+	void clearCSG();
 	bool maybeSave();
 	bool checkModified();
 	static void consoleOutput(const QString &msg, void *userdata) {
@@ -13,6 +13,8 @@
 #include <CGAL/Exact_predicates_exact_constructions_kernel.h>
 #include <CGAL/Polygon_2.h>
 #include <CGAL/Polygon_with_holes_2.h>
+#include <boost/shared_ptr.hpp>
+#include <string>
 
 typedef CGAL::Extended_cartesian<CGAL::Gmpq> CGAL_Kernel2;
 typedef CGAL::Nef_polyhedron_2<CGAL_Kernel2> CGAL_Nef_polyhedron2;
@@ -31,11 +33,20 @@ typedef CGAL::Exact_predicates_exact_constructions_kernel CGAL_ExactKernel2;
 typedef CGAL::Polygon_2<CGAL_ExactKernel2> CGAL_Poly2;
 typedef CGAL::Polygon_with_holes_2<CGAL_ExactKernel2> CGAL_Poly2h;
 
+/*!
+	Result of a CGAL render. Only the polyhedron of the active dimension is
+	kept, behind a shared handle to an immutable object, so copying results
+	around (e.g. on every cache hit) only bumps a reference count. Booleans
+	build a new polyhedron and replace the handle. They treat an operand of
+	another dimension, or of none, as empty. In-place edits must go through
+	edit2() and edit3(), which copy the polyhedron first if anyone else
+	still holds it.
+*/
 struct CGAL_Nef_polyhedron
 {
 	int dim;
-	CGAL_Nef_polyhedron2 p2;
-	CGAL_Nef_polyhedron3 p3;
+	boost::shared_ptr<const CGAL_Nef_polyhedron2> p2;  // only set if dim == 2
+	boost::shared_ptr<const CGAL_Nef_polyhedron3> p3;  // only set if dim == 3
 
 	CGAL_Nef_polyhedron() {
 		dim = 0;
@@ -43,59 +54,116 @@ struct CGAL_Nef_polyhedron
 
 	CGAL_Nef_polyhedron(const CGAL_Nef_polyhedron2 &p) {
 		dim = 2;
-		p2 = p;
+		p2.reset(new CGAL_Nef_polyhedron2(p));
 	}
 
 	CGAL_Nef_polyhedron(const CGAL_Nef_polyhedron3 &p) {
 		dim = 3;
-		p3 = p;
+		p3.reset(new CGAL_Nef_polyhedron3(p));
 	}
 
+	/*!
+		The booleans treat a result without a dimension as empty, and so an
+		operand whose dimension differs from that of this result.
+	*/
 	CGAL_Nef_polyhedron& operator+=(const CGAL_Nef_polyhedron &other) {
-		if (other.dim == 2) {
-			this->p2 += other.p2;
-			this->dim = 2;
-		}
-		if (other.dim == 3) {
-			this->p3 += other.p3;
-			this->dim = 3;
-		}
+		if (dim == 0)
+			return *this = other;
+		if (other.dim == 2 && dim == 2)
+			p2.reset(new CGAL_Nef_polyhedron2(*p2 + *other.p2));
+		if (other.dim == 3 && dim == 3)
+			p3.reset(new CGAL_Nef_polyhedron3(*p3 + *other.p3));
 		return *this;
 	}
 
 	CGAL_Nef_polyhedron& operator*=(const CGAL_Nef_polyhedron &other) {
-		if (other.dim == 2) {
-			this->p2 *= other.p2;
-			this->dim = 2;
-		}
-		if (other.dim == 3) {
-			this->p3 *= other.p3;
-			this->dim = 3;
-		}
+		if (other.dim != dim)
+			return *this = empty();
+		if (dim == 2)
+			p2.reset(new CGAL_Nef_polyhedron2(*p2 * *other.p2));
+		if (dim == 3)
+			p3.reset(new CGAL_Nef_polyhedron3(*p3 * *other.p3));
 		return *this;
 	}
 
 	CGAL_Nef_polyhedron& operator-=(const CGAL_Nef_polyhedron &other) {
-		if (other.dim == 2) {
-			this->p2 -= other.p2;
-			this->dim = 2;
-		}
-		if (other.dim == 3) {
-			this->p3 -= other.p3;
-			this->dim = 3;
-		}
+		if (other.dim == 2 && dim == 2)
+			p2.reset(new CGAL_Nef_polyhedron2(*p2 - *other.p2));
+		if (other.dim == 3 && dim == 3)
+			p3.reset(new CGAL_Nef_polyhedron3(*p3 - *other.p3));
 		return *this;
 	}
 
-	int weight() {
+	/*!
+		Returns an empty polyhedron of the same dimension.
+	*/
+	CGAL_Nef_polyhedron empty() const {
 		if (dim == 2)
-			return p2.explorer().number_of_vertices();
+			return CGAL_Nef_polyhedron(CGAL_Nef_polyhedron2());
 		if (dim == 3)
-			return p3.number_of_vertices();
+			return CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3());
+		return CGAL_Nef_polyhedron();
+	}
+
+	/*!
+		Returns the 2D polyhedron for modification, making this a 2D result
+		and copying the polyhedron first if it is shared.
+	*/
+	CGAL_Nef_polyhedron2 &edit2() {
+		if (dim != 2)
+			*this = CGAL_Nef_polyhedron(CGAL_Nef_polyhedron2());
+		else if (!p2.unique())
+			p2.reset(new CGAL_Nef_polyhedron2(*p2));
+		return const_cast<CGAL_Nef_polyhedron2&>(*p2);
+	}
+
+	/*!
+		Returns the 3D polyhedron for modification, making this a 3D result
+		and copying the polyhedron first if it is shared.
+	*/
+	CGAL_Nef_polyhedron3 &edit3() {
+		if (dim != 3)
+			*this = CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3());
+		else if (!p3.unique())
+			p3.reset(new CGAL_Nef_polyhedron3(*p3));
+		return const_cast<CGAL_Nef_polyhedron3&>(*p3);
+	}
+
+	int weight() const {
+		if (dim == 2)
+			return p2->explorer().number_of_vertices();
+		if (dim == 3)
+			return p3->number_of_vertices();
 		return 0;
 	}
 };
 
+/*!
+	Resolution of the grid coordinates are snapped to before they enter the
+	Nef kernel, or 0 to convert the doubles unchanged. A double converts to a
+	rational with a 53 bit mantissa, and those grow with every boolean
+	operation. Snapped coordinates stay short fractions.
+*/
+extern double cgal_quantize_grid;
+
+/*!
+	cgal_quantize_grid as the exact fraction it was given as, e.g. 3/10000
+	for 0.0003, rather than the binary approximation of the double.
+*/
+extern CGAL::Gmpq cgal_quantize_step;
+
+bool cgal_set_quantize_grid(const std::string &text);
+
+/*!
+	Converts x to an exact number, snapped to cgal_quantize_grid if enabled.
+*/
+inline CGAL::Gmpq cgal_quantize(double x)
+{
+	if (cgal_quantize_grid <= 0)
+		return CGAL::Gmpq(x);
+	return CGAL::Gmpq(floor(x / cgal_quantize_grid + 0.5)) * cgal_quantize_step;
+}
+
 #endif /* ENABLE_CGAL */
 
 #endif
@@ -68,10 +68,10 @@ CGAL_Nef_polyhedron CgaladvMinkowskiNode::render_cgal_nef_polyhedron() const {
 	  } else {
 		  CGAL_Nef_polyhedron tmp = v->render_cgal_nef_polyhedron();
 		  if (N.dim == 3 && tmp.dim == 3) {
-			  N.p3 = minkowski3(N.p3, tmp.p3);
+			  N = CGAL_Nef_polyhedron(minkowski3(*N.p3, *tmp.p3));
 		  }
 		  if (N.dim == 2 && tmp.dim == 2) {
-			  N.p2 = minkowski2(N.p2, tmp.p2);
+			  N = CGAL_Nef_polyhedron(minkowski2(*N.p2, *tmp.p2));
 		  }
 	  }
 	  v->progress_report();
@@ -116,13 +116,13 @@ CGAL_Nef_polyhedron CgaladvHullNode::render_cgal_nef_polyhedron() const {
       all2d=false;
 	  }
 	  if (N.dim == 2) {
-      polys.push_back(N.p2);
+      polys.push_back(*N.p2);
 	  }
 	  v->progress_report();
   }
 
-  if (all2d)
-	  N.p2 = convexhull2(polys);
+  if (all2d && N.dim == 2)
+	  N = CGAL_Nef_polyhedron(convexhull2(polys));
 
   cgal_nef_cache.insert(cache_id, new cgal_nef_cache_entry(N), N.weight());
   print_messages_pop();
@@ -157,73 +157,28 @@ CSGTerm *CgaladvNode::render_csg_term(const Float20 &m, QVector<CSGTerm*> *highl
 
 #endif // ENABLE_CGAL
 
-QString CgaladvNode::dumpChildren(QString indent) const
+void CgaladvNode::dump_statement(QTextStream &out) const
 {
-      QString text;
-      foreach (AbstractNode::Pointer v, this->children)
-	      text += v->dump(indent + QString("\t"));
-  return text;
+  out << "CgaladvNode()";
 }
 
-QString CgaladvNode::dump(QString indent) const
+void CgaladvMinkowskiNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-      QString text;
-      text.sprintf("CgaladvNode() {\n");
-      text += dumpChildren(indent);
-      text += indent + "}\n";
-      ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  out << QString("minkowski(convexity = %1)").arg(this->convexity);
 }
 
-
-QString CgaladvMinkowskiNode::dump(QString indent) const
+void CgaladvGlideNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-      QString text;
-      text.sprintf("minkowski(convexity = %d) {\n", this->convexity);
-      text += dumpChildren(indent);
-      text += indent + "}\n";
-      ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  out << QString("glide(path = undef, convexity = %1)").arg(this->convexity);
 }
 
-QString CgaladvGlideNode::dump(QString indent) const
+void CgaladvSubdivNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-      QString text;
-      text.sprintf(", convexity = %d) {\n", this->convexity);
-      text = QString("glide(path = undef") + text;
-      text += dumpChildren(indent);
-      text += indent + "}\n";
-      ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  out << QString("subdiv(level = %1, convexity = %2)").arg(this->level).arg(this->convexity);
 }
 
-QString CgaladvSubdivNode::dump(QString indent) const
+void CgaladvHullNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-      QString text;
-      text.sprintf("subdiv(level = %d, convexity = %d) {\n", this->level, this->convexity);
-      text += dumpChildren(indent);
-      text += indent + "}\n";
-      ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
-}
-
-QString CgaladvHullNode::dump(QString indent) const
-{
-  if (dump_cache.isEmpty()) {
-      QString text;
-      text.sprintf("hull() {\n");
-      text += dumpChildren(indent);
-      text += indent + "}\n";
-      ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  out << "hull()";
 }
 
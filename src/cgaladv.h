@@ -38,8 +38,7 @@ public:
 #ifndef ENABLE_CGAL
     virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
 #endif
-    virtual QString dump(QString indent) const;
-    QString dumpChildren(QString indent) const;
+    virtual void dump_statement(QTextStream &out) const;
 };
 
 class CgaladvMinkowskiNode : public CgaladvNode {
@@ -50,7 +49,10 @@ public:
     virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
     virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
 #endif
-    virtual QString dump(QString indent) const;
+    virtual void dump_statement(QTextStream &out) const;
+    virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+      return clone_as(this, children);
+    }
 };
 
 class CgaladvGlideNode : public CgaladvNode {
@@ -61,7 +63,10 @@ public:
     virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
     virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
 #endif
-    virtual QString dump(QString indent) const;
+    virtual void dump_statement(QTextStream &out) const;
+    virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+      return clone_as(this, children);
+    }
 };
 
 class CgaladvSubdivNode : public CgaladvNode {
@@ -74,7 +79,10 @@ public:
     virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
     virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
 #endif
-    virtual QString dump(QString indent) const;
+    virtual void dump_statement(QTextStream &out) const;
+    virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+      return clone_as(this, children);
+    }
 };
 
 class CgaladvHullNode : public CgaladvNode {
@@ -85,7 +93,10 @@ public:
     virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
     virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
 #endif
-    virtual QString dump(QString indent) const;
+    virtual void dump_statement(QTextStream &out) const;
+    virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+      return clone_as(this, children);
+    }
 };
 
 #endif
@@ -41,7 +41,7 @@ CGAL_Nef_polyhedron2 convexhull2(std::list<CGAL_Nef_polyhedron2> a)
 		CGAL_Poly2 ap=nef2p2(*i);
 		for (int j=0;j<ap.size();j++) {
 	    double x=to_double(ap[j].x()),y=to_double(ap[j].y());
-	    CGAL_Nef_polyhedron2::Point p=CGAL_Nef_polyhedron2::Point(x,y);
+	    CGAL_Nef_polyhedron2::Point p=CGAL_Nef_polyhedron2::Point(cgal_quantize(x), cgal_quantize(y));
 	    points.push_back(p);
 		}
 	}
@@ -114,7 +114,7 @@ static CGAL_Nef_polyhedron2 p2nef2(CGAL_Poly2 p2) {
   for (unsigned int j = 0; j < p2.size(); j++) {
     double x = to_double(p2[j].x());
     double y = to_double(p2[j].y());
-    CGAL_Nef_polyhedron2::Point p = CGAL_Nef_polyhedron2::Point(x, y);
+    CGAL_Nef_polyhedron2::Point p = CGAL_Nef_polyhedron2::Point(cgal_quantize(x), cgal_quantize(y));
     points.push_back(p);
   }
   return CGAL_Nef_polyhedron2(points.begin(), points.end(), CGAL_Nef_polyhedron2::INCLUDED);
@@ -26,18 +26,85 @@
 
 
 #include "csgops.h"
+#include "transform.h"
 #include "printutils.h"
 #ifdef ENABLE_CGAL
+#  include "planner.h"
 #  include <CGAL/assertions_behaviour.h>
 #  include <CGAL/exceptions.h>
 #endif
 
+#include <QCryptographicHash>
 #include <boost/make_shared.hpp>
 using boost::make_shared;
 
 
 #ifdef ENABLE_CGAL
 
+// Chains with at least this many operands are folded as a balanced tree
+static const int TREE_FOLD_MIN = 8;
+
+/*!
+	Unions the operands [lo, hi) as a balanced tree. Every partial result
+	of two or more operands is cached by the hashes of their cache ids, so
+	after editing one child of a long chain only the O(log n) partial
+	results containing it are computed again.
+*/
+static CGAL_Nef_polyhedron render_union_range(const AbstractNode::NodeList &operands, const QVector<QByteArray> &hashes, int lo, int hi)
+{
+	if (hi - lo == 1) {
+		CGAL_Nef_polyhedron N = operands[lo]->render_cgal_nef_polyhedron();
+		operands[lo]->progress_report();
+		return N;
+	}
+
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	for (int i = lo; i < hi; i++)
+		hash.addData(hashes[i]);
+	QString key = QString("union-range:") + hash.result().toHex();
+	if (AbstractNode::cgal_nef_cache.contains(key)) {
+		for (int i = lo; i < hi; i++)
+			operands[i]->progress_report();
+		PRINT(AbstractNode::cgal_nef_cache[key]->msg);
+		return AbstractNode::cgal_nef_cache[key]->N;
+	}
+
+	print_messages_push();
+	int mid = (lo + hi) / 2;
+	CGAL_Nef_polyhedron N = render_union_range(operands, hashes, lo, mid);
+	CGAL_Nef_polyhedron N2 = render_union_range(operands, hashes, mid, hi);
+	N += N2;
+	N = AbstractNode::snap_cgal_nef_polyhedron(N);
+	AbstractNode::cgal_nef_cache.insert(key, new AbstractNode::cgal_nef_cache_entry(N), N.weight());
+	print_messages_pop();
+	return N;
+}
+
+/*!
+	Renders a long union, or a long difference as its first operand minus
+	the union of all others, using render_union_range().
+*/
+static CGAL_Nef_polyhedron render_tree_fold(const AbstractNode::NodeList &operands, csg_type_e type)
+{
+	QVector<QByteArray> hashes;
+	foreach (AbstractNode::Pointer v, operands)
+		hashes.append(QCryptographicHash::hash(v->mk_cache_id().toUtf8(), QCryptographicHash::Sha1));
+
+	if (type == CSG_TYPE_UNION)
+		return render_union_range(operands, hashes, 0, operands.size());
+
+	CGAL_Nef_polyhedron N;
+	int first = 0;
+	while (N.dim == 0 && first < operands.size()) {
+		N = operands[first]->render_cgal_nef_polyhedron();
+		operands[first++]->progress_report();
+	}
+	if (first < operands.size()) {
+		N -= render_union_range(operands, hashes, first, operands.size());
+	}
+	return N;
+}
+
 CGAL_Nef_polyhedron CsgNode::render_cgal_nef_polyhedron() const
 {
 	QString cache_id = mk_cache_id();
@@ -49,36 +116,46 @@ CGAL_Nef_polyhedron CsgNode::render_cgal_nef_polyhedron() const
 
 	print_messages_push();
 
+	CGAL_Nef_polyhedron N;
+	if ((render_engine == ENGINE_CONCAT && RenderPlanner::render_concat(this, N)) || render_engine == ENGINE_EMPTY ||
+			TransformNode::render_cgal_nef_translated(this, type, N)) {
+		// Disjoint intersections are empty without looking at the operands
+		if (render_engine == ENGINE_EMPTY)
+			N = CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3());
+		cgal_nef_cache.insert(cache_id, new cgal_nef_cache_entry(N), N.weight());
+		print_messages_pop();
+		progress_report();
+		return N;
+	}
+
+	AbstractNode::NodeList operands;
+	foreach (AbstractNode::Pointer v, children) {
+		if (!v->props.background)
+			operands.append(v);
+	}
+
 	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
 	bool first = true;
-	CGAL_Nef_polyhedron N;
 	try {
-	foreach (AbstractNode::Pointer v, children) {
-		if (v->props.background)
-			continue;
+	if (type != CSG_TYPE_INTERSECTION && operands.size() >= TREE_FOLD_MIN)
+		N = render_tree_fold(operands, type);
+	else
+	foreach (AbstractNode::Pointer v, operands) {
 		if (first) {
 			N = v->render_cgal_nef_polyhedron();
 			if (N.dim != 0)
 				first = false;
-		} else if (N.dim == 2) {
-			if (type == CSG_TYPE_UNION) {
-				N.p2 += v->render_cgal_nef_polyhedron().p2;
-			} else if (type == CSG_TYPE_DIFFERENCE) {
-				N.p2 -= v->render_cgal_nef_polyhedron().p2;
-			} else if (type == CSG_TYPE_INTERSECTION) {
-				N.p2 *= v->render_cgal_nef_polyhedron().p2;
-			}
-		} else if (N.dim == 3) {
-			if (type == CSG_TYPE_UNION) {
-				N.p3 += v->render_cgal_nef_polyhedron().p3;
-			} else if (type == CSG_TYPE_DIFFERENCE) {
-				N.p3 -= v->render_cgal_nef_polyhedron().p3;
-			} else if (type == CSG_TYPE_INTERSECTION) {
-				N.p3 *= v->render_cgal_nef_polyhedron().p3;
-			}
+		} else if (type == CSG_TYPE_UNION) {
+			N += v->render_cgal_nef_polyhedron();
+		} else if (type == CSG_TYPE_DIFFERENCE) {
+			N -= v->render_cgal_nef_polyhedron();
+		} else if (type == CSG_TYPE_INTERSECTION) {
+			N *= v->render_cgal_nef_polyhedron();
 		}
 		v->progress_report();
 	}
+	if (children.size() > 1)
+		N = snap_cgal_nef_polyhedron(N);
 	cgal_nef_cache.insert(cache_id, new cgal_nef_cache_entry(N), N.weight());
 	}
 	catch (CGAL::Assertion_exception e) {
@@ -120,20 +197,13 @@ CSGTerm *CsgNode::render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlight
 	return t1;
 }
 
-QString CsgNode::dump(QString indent) const
+void CsgNode::dump_statement(QTextStream &out) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text = indent + QString("n%1: ").arg(idx);
-		if (type == CSG_TYPE_UNION)
-			text += "union() {\n";
-		if (type == CSG_TYPE_DIFFERENCE)
-			text += "difference() {\n";
-		if (type == CSG_TYPE_INTERSECTION)
-			text += "intersection() {\n";
-		foreach (AbstractNode::Pointer v, children)
-			text += v->dump(indent + QString("\t"));
-		((AbstractNode*)this)->dump_cache = text + indent + "}\n";
-	}
-	return dump_cache;
+	if (type == CSG_TYPE_UNION)
+		out << "union()";
+	if (type == CSG_TYPE_DIFFERENCE)
+		out << "difference()";
+	if (type == CSG_TYPE_INTERSECTION)
+		out << "intersection()";
 }
 
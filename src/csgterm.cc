@@ -26,52 +26,222 @@
 
 #include "csgterm.h"
 #include "polyset.h"
-#include <boost/make_shared.hpp>
+#include "mathc99.h"
+#include <algorithm>
+
+/*!
+	Computes the bounding box of a PolySet placed by m. 2D objects are
+	rendered as slabs of some height, so they are unbounded in z, and so
+	is anything under a projective matrix.
+*/
+static void polyset_bbox(const PolySet *ps, const Float20 &m, double *bbox)
+{
+	for (int k = 0; k < 3; k++)
+		bbox[k] = HUGE_VAL, bbox[k+3] = -HUGE_VAL;
+	if (!ps || ps->vertex_count() == 0)
+		return;
+
+	double lo[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL }, hi[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+	for (int i = 0; i < ps->vertex_count(); i++) {
+		double v[3] = { ps->vx[i], ps->vy[i], ps->vz[i] };
+		for (int k = 0; k < 3; k++)
+			lo[k] = std::min(lo[k], v[k]), hi[k] = std::max(hi[k], v[k]);
+	}
+	if (m[3] != 0 || m[7] != 0 || m[11] != 0 || m[15] != 1) {
+		for (int k = 0; k < 3; k++)
+			bbox[k] = -HUGE_VAL, bbox[k+3] = HUGE_VAL;
+		return;
+	}
+	for (int c = 0; c < 8; c++) {
+		double p[3] = { c & 1 ? hi[0] : lo[0], c & 2 ? hi[1] : lo[1], c & 4 ? hi[2] : lo[2] };
+		for (int k = 0; k < 3; k++) {
+			double x = m[k]*p[0] + m[k+4]*p[1] + m[k+8]*p[2] + m[k+12];
+			bbox[k] = std::min(bbox[k], x), bbox[k+3] = std::max(bbox[k+3], x);
+		}
+	}
+	if (ps->is2d)
+		bbox[2] = -HUGE_VAL, bbox[5] = HUGE_VAL;
+}
+
+static bool bboxes_disjoint(const double *a, const double *b)
+{
+	for (int k = 0; k < 3; k++) {
+		if (a[k] > a[k+3] || b[k] > b[k+3] || a[k+3] < b[k] || b[k+3] < a[k])
+			return true;
+	}
+	return false;
+}
 
 CSGTerm::CSGTerm(PolySet *polyset, const Float20 &m, QString label)
   :type(TYPE_PRIMITIVE),polyset(polyset),label(label),left(NULL),right(NULL),
-  m(m),refcounter(1) {}
+  m(m),refcounter(1)
+{
+	polyset_bbox(polyset, m, bbox);
+}
 
 CSGTerm::CSGTerm(type_e type, CSGTerm *left, CSGTerm *right)
-  :type(type), polyset(NULL), left(left), right(right), refcounter(1) {}
+  :type(type), polyset(NULL), left(left), right(right), refcounter(1)
+{
+	for (int k = 0; k < 3; k++) {
+		if (type == TYPE_UNION) {
+			bbox[k] = std::min(left->bbox[k], right->bbox[k]);
+			bbox[k+3] = std::max(left->bbox[k+3], right->bbox[k+3]);
+		} else if (type == TYPE_INTERSECTION) {
+			bbox[k] = std::max(left->bbox[k], right->bbox[k]);
+			bbox[k+3] = std::min(left->bbox[k+3], right->bbox[k+3]);
+		} else {
+			bbox[k] = left->bbox[k];
+			bbox[k+3] = left->bbox[k+3];
+		}
+	}
+}
 
-CSGTerm *CSGTerm::normalize()
+CSGTerm *CSGTerm::link()
 {
-	// This function implements the CSG normalization
-	// Reference: Florian Kirsch, Juergen Doeller,
-	// OpenCSG: A Library for Image-Based CSG Rendering,
-	// University of Potsdam, Hasso-Plattner-Institute, Germany
-	// http://www.opencsg.org/data/csg_freenix2005_paper.pdf
+	refcounter++;
+	return this;
+}
 
-	if (type == TYPE_PRIMITIVE)
-		return link();
+void CSGTerm::unlink()
+{
+	if (--refcounter <= 0) {
+		if (polyset)
+			polyset->unlink();
+		if (left)
+			left->unlink();
+		if (right)
+			right->unlink();
+		delete this;
+	}
+}
+
+QString CSGTerm::dump()
+{
+	if (type == TYPE_UNION)
+		return QString("(%1 + %2)").arg(left->dump(), right->dump());
+	if (type == TYPE_INTERSECTION)
+		return QString("(%1 * %2)").arg(left->dump(), right->dump());
+	if (type == TYPE_DIFFERENCE)
+		return QString("(%1 - %2)").arg(left->dump(), right->dump());
+	return label;
+}
 
-	CSGTerm *t1, *t2, *x, *y;
+struct CSGNormalizerBudgetException { };
 
-	x = left->normalize();
-	y = right->normalize();
+CSGNormalizer::CSGNormalizer(int max_elements) : exceeded(false), max_elements(max_elements)
+{
+	Float20 m;
+	m.assign(0);
+	empty = new CSGTerm(NULL, m, "empty");
+}
 
-	if (x != left || y != right) {
-		t1 = new CSGTerm(type, x, y);
-	} else {
-		t1 = link();
-		x->unlink();
-		y->unlink();
+CSGNormalizer::~CSGNormalizer()
+{
+	foreach (CSGTerm *t, terms)
+		t->unlink();
+	empty->unlink();
+}
+
+/*!
+	Returns the normalized term, or NULL if no product of it is left. Sets
+	exceeded and returns NULL as soon as any normalized sub-term would give
+	a rendering chain of more than max_elements elements.
+*/
+CSGTerm *CSGNormalizer::normalize(CSGTerm *term)
+{
+	exceeded = false;
+	try {
+		while (1) {
+			CSGTerm *n = norm(term);
+			if (n == term)
+				break;
+			term = n;
+		}
+		return term == empty ? NULL : term->link();
+	}
+	catch (CSGNormalizerBudgetException) {
+		exceeded = true;
+		return NULL;
 	}
+}
 
-	while (1) {
-		t2 = t1->normalize_tail();
-		t1->unlink();
-		if (t1 == t2)
-			break;
-		t1 = t2;
+/*!
+	Returns the one term of the given type and operands. Intersections of
+	objects whose bounding boxes are disjoint are empty, and so are
+	differences from empty objects, and subtracting an object that misses
+	the bounding box leaves the box unchanged.
+*/
+CSGTerm *CSGNormalizer::mk(CSGTerm::type_e type, CSGTerm *left, CSGTerm *right)
+{
+	if (left == empty || right == empty) {
+		if (type == CSGTerm::TYPE_UNION)
+			return left == empty ? right : left;
+		if (type == CSGTerm::TYPE_DIFFERENCE)
+			return left;
+		return empty;
 	}
+	if (type != CSGTerm::TYPE_UNION && bboxes_disjoint(left->bbox, right->bbox))
+		return type == CSGTerm::TYPE_INTERSECTION ? empty : left;
+
+	cons_key_t key(QPair<int, CSGTerm*>(type, left), right);
+	if (!terms.contains(key))
+		terms.insert(key, new CSGTerm(type, left->link(), right->link()));
+	return terms[key];
+}
+
+/*!
+	Returns the number of primitives in the rendering chain of a normalized
+	term, throwing as soon as it exceeds the budget.
+*/
+int CSGNormalizer::count(CSGTerm *term)
+{
+	if (term->type == CSGTerm::TYPE_PRIMITIVE)
+		return 1;
+	if (!elements.contains(term)) {
+		int n = count(term->left) + count(term->right);
+		if (n > max_elements)
+			throw CSGNormalizerBudgetException();
+		elements.insert(term, n);
+	}
+	return elements[term];
+}
+
+CSGTerm *CSGNormalizer::norm(CSGTerm *term)
+{
+	// This function implements the CSG normalization
+	// Reference: Florian Kirsch, Juergen Doeller,
+	// OpenCSG: A Library for Image-Based CSG Rendering,
+	// University of Potsdam, Hasso-Plattner-Institute, Germany
+	// http://www.opencsg.org/data/csg_freenix2005_paper.pdf
 
-	return t1;
+	if (term->type == CSGTerm::TYPE_PRIMITIVE)
+		return term;
+	if (normalized.contains(term))
+		return normalized[term];
+
+	// One pass: normalize the operands, then rewrite the top of the term
+	// until no rule applies. normalize() repeats passes until nothing
+	// changes.
+	CSGTerm *t = mk(term->type, norm(term->left), norm(term->right));
+	while (CSGTerm *r = rewrite(t))
+		t = r;
+	count(t);
+
+	normalized.insert(term, t);
+	return t;
 }
 
-CSGTerm *CSGTerm::normalize_tail()
+/*!
+	Applies the first matching normalization rule to the top of a term, or
+	returns NULL if none applies.
+*/
+CSGTerm *CSGNormalizer::rewrite(CSGTerm *term)
 {
+	if (term->type == CSGTerm::TYPE_PRIMITIVE)
+		return NULL;
+
+	CSGTerm::type_e type = term->type;
+	CSGTerm *left = term->left, *right = term->right;
 	CSGTerm *x, *y, *z;
 
 	// Part A: The 'x . (y . z)' expressions
@@ -81,28 +251,28 @@ CSGTerm *CSGTerm::normalize_tail()
 	z = right->right;
 
 	// 1.  x - (y + z) -> (x - y) - z
-	if (type == TYPE_DIFFERENCE && right->type == TYPE_UNION)
-		return new CSGTerm(TYPE_DIFFERENCE, new CSGTerm(TYPE_DIFFERENCE, x->link(), y->link()), z->link());
+	if (type == CSGTerm::TYPE_DIFFERENCE && right->type == CSGTerm::TYPE_UNION)
+		return mk(CSGTerm::TYPE_DIFFERENCE, mk(CSGTerm::TYPE_DIFFERENCE, x, y), z);
 
 	// 2.  x * (y + z) -> (x * y) + (x * z)
-	if (type == TYPE_INTERSECTION && right->type == TYPE_UNION)
-		return new CSGTerm(TYPE_UNION, new CSGTerm(TYPE_INTERSECTION, x->link(), y->link()), new CSGTerm(TYPE_INTERSECTION, x->link(), z->link()));
+	if (type == CSGTerm::TYPE_INTERSECTION && right->type == CSGTerm::TYPE_UNION)
+		return mk(CSGTerm::TYPE_UNION, mk(CSGTerm::TYPE_INTERSECTION, x, y), mk(CSGTerm::TYPE_INTERSECTION, x, z));
 
 	// 3.  x - (y * z) -> (x - y) + (x - z)
-	if (type == TYPE_DIFFERENCE && right->type == TYPE_INTERSECTION)
-		return new CSGTerm(TYPE_UNION, new CSGTerm(TYPE_DIFFERENCE, x->link(), y->link()), new CSGTerm(TYPE_DIFFERENCE, x->link(), z->link()));
+	if (type == CSGTerm::TYPE_DIFFERENCE && right->type == CSGTerm::TYPE_INTERSECTION)
+		return mk(CSGTerm::TYPE_UNION, mk(CSGTerm::TYPE_DIFFERENCE, x, y), mk(CSGTerm::TYPE_DIFFERENCE, x, z));
 
 	// 4.  x * (y * z) -> (x * y) * z
-	if (type == TYPE_INTERSECTION && right->type == TYPE_INTERSECTION)
-		return new CSGTerm(TYPE_INTERSECTION, new CSGTerm(TYPE_INTERSECTION, x->link(), y->link()), z->link());
+	if (type == CSGTerm::TYPE_INTERSECTION && right->type == CSGTerm::TYPE_INTERSECTION)
+		return mk(CSGTerm::TYPE_INTERSECTION, mk(CSGTerm::TYPE_INTERSECTION, x, y), z);
 
 	// 5.  x - (y - z) -> (x - y) + (x * z)
-	if (type == TYPE_DIFFERENCE && right->type == TYPE_DIFFERENCE)
-		return new CSGTerm(TYPE_UNION, new CSGTerm(TYPE_DIFFERENCE, x->link(), y->link()), new CSGTerm(TYPE_INTERSECTION, x->link(), z->link()));
+	if (type == CSGTerm::TYPE_DIFFERENCE && right->type == CSGTerm::TYPE_DIFFERENCE)
+		return mk(CSGTerm::TYPE_UNION, mk(CSGTerm::TYPE_DIFFERENCE, x, y), mk(CSGTerm::TYPE_INTERSECTION, x, z));
 
 	// 6.  x * (y - z) -> (x * y) - z
-	if (type == TYPE_INTERSECTION && right->type == TYPE_DIFFERENCE)
-		return new CSGTerm(TYPE_DIFFERENCE, new CSGTerm(TYPE_INTERSECTION, x->link(), y->link()), z->link());
+	if (type == CSGTerm::TYPE_INTERSECTION && right->type == CSGTerm::TYPE_DIFFERENCE)
+		return mk(CSGTerm::TYPE_DIFFERENCE, mk(CSGTerm::TYPE_INTERSECTION, x, y), z);
 
 	// Part B: The '(x . y) . z' expressions
 
@@ -111,86 +281,81 @@ CSGTerm *CSGTerm::normalize_tail()
 	z = right;
 
 	// 7. (x - y) * z  -> (x * z) - y
-	if (left->type == TYPE_DIFFERENCE && type == TYPE_INTERSECTION)
-		return new CSGTerm(TYPE_DIFFERENCE, new CSGTerm(TYPE_INTERSECTION, x->link(), z->link()), y->link());
+	if (left->type == CSGTerm::TYPE_DIFFERENCE && type == CSGTerm::TYPE_INTERSECTION)
+		return mk(CSGTerm::TYPE_DIFFERENCE, mk(CSGTerm::TYPE_INTERSECTION, x, z), y);
 
 	// 8. (x + y) - z  -> (x - z) + (y - z)
-	if (left->type == TYPE_UNION && type == TYPE_DIFFERENCE)
-		return new CSGTerm(TYPE_UNION, new CSGTerm(TYPE_DIFFERENCE, x->link(), z->link()), new CSGTerm(TYPE_DIFFERENCE, y->link(), z->link()));
+	if (left->type == CSGTerm::TYPE_UNION && type == CSGTerm::TYPE_DIFFERENCE)
+		return mk(CSGTerm::TYPE_UNION, mk(CSGTerm::TYPE_DIFFERENCE, x, z), mk(CSGTerm::TYPE_DIFFERENCE, y, z));
 
 	// 9. (x + y) * z  -> (x * z) + (y * z)
-	if (left->type == TYPE_UNION && type == TYPE_INTERSECTION)
-		return new CSGTerm(TYPE_UNION, new CSGTerm(TYPE_INTERSECTION, x->link(), z->link()), new CSGTerm(TYPE_INTERSECTION, y->link(), z->link()));
+	if (left->type == CSGTerm::TYPE_UNION && type == CSGTerm::TYPE_INTERSECTION)
+		return mk(CSGTerm::TYPE_UNION, mk(CSGTerm::TYPE_INTERSECTION, x, z), mk(CSGTerm::TYPE_INTERSECTION, y, z));
 
-	return link();
-}
-
-CSGTerm *CSGTerm::link()
-{
-	refcounter++;
-	return this;
+	return NULL;
 }
 
-void CSGTerm::unlink()
+CSGChain::CSGChain()
 {
-	if (--refcounter <= 0) {
-		if (polyset)
-			polyset->unlink();
-		if (left)
-			left->unlink();
-		if (right)
-			right->unlink();
-		delete this;
-	}
 }
 
-QString CSGTerm::dump()
+void CSGChain::add(PolySet *polyset, const Float20 &m, CSGTerm::type_e type, QString label)
 {
-	if (type == TYPE_UNION)
-		return QString("(%1 + %2)").arg(left->dump(), right->dump());
-	if (type == TYPE_INTERSECTION)
-		return QString("(%1 * %2)").arg(left->dump(), right->dump());
-	if (type == TYPE_DIFFERENCE)
-		return QString("(%1 - %2)").arg(left->dump(), right->dump());
-	return label;
+	Element e;
+	e.polyset = polyset;
+	for (int i = 0; i < 16; i++)
+		e.m[i] = m[i];
+	for (int i = 0; i < 4; i++)
+		e.color[i] = m[16+i];
+	e.mirrored = m[0]*(m[5]*m[10] - m[9]*m[6]) - m[4]*(m[1]*m[10] - m[9]*m[2]) + m[8]*(m[1]*m[6] - m[5]*m[2]) < 0;
+	e.type = type;
+	elements.push_back(e);
+	labels.append(label);
 }
 
-CSGChain::CSGChain()
+/*!
+	Appends the products of a normalized term, sizing the chain once for
+	all of them.
+*/
+void CSGChain::import(CSGTerm *term, CSGTerm::type_e type)
 {
+	int n = count(term);
+	elements.reserve(elements.size() + n);
+	labels.reserve(labels.size() + n);
+	append(term, type);
 }
 
-void CSGChain::add(PolySet *polyset, const Float20 &m, CSGTerm::type_e type, QString label)
+int CSGChain::count(CSGTerm *term)
 {
-	polysets.append(polyset);
-	Float20Ptr mp(boost::make_shared<Float20>(m));
-	matrices.append(mp);
-	types.append(type);
-	labels.append(label);
+	if (term->type == CSGTerm::TYPE_PRIMITIVE)
+		return 1;
+	return count(term->left) + count(term->right);
 }
 
-void CSGChain::import(CSGTerm *term, CSGTerm::type_e type)
+void CSGChain::append(CSGTerm *term, CSGTerm::type_e type)
 {
 	if (term->type == CSGTerm::TYPE_PRIMITIVE) {
 		add(term->polyset, term->m, type, term->label);
 	} else {
-		import(term->left, type);
-		import(term->right, term->type);
+		append(term->left, type);
+		append(term->right, term->type);
 	}
 }
 
 QString CSGChain::dump()
 {
 	QString text;
-	for (int i = 0; i < types.size(); i++)
+	for (int i = 0; i < size(); i++)
 	{
-		if (types[i] == CSGTerm::TYPE_UNION) {
+		int type = elements[i].type;
+		if (type == CSGTerm::TYPE_UNION) {
 			if (i != 0)
 				text += "\n";
 			text += "+";
 		}
-		if (types[i] == CSGTerm::TYPE_DIFFERENCE)
+		if (type == CSGTerm::TYPE_DIFFERENCE)
 			text += " -";
-		if (types[i] == CSGTerm::TYPE_INTERSECTION)
+		if (type == CSGTerm::TYPE_INTERSECTION)
 			text += " *";
 		text += labels[i];
 	}
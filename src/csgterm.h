@@ -3,7 +3,10 @@
 
 #include <QString>
 #include <QVector>
+#include <QHash>
+#include <QPair>
 #include "matrix.h"
+#include <vector>
 #include <boost/shared_ptr.hpp>
 
 class CSGTerm
@@ -22,32 +25,82 @@ public:
 	CSGTerm *left;
 	CSGTerm *right;
 	Float20 m;
+	double bbox[6];  // min x, y, z, max x, y, z; empty if min > max
 	int refcounter;
 
 	CSGTerm(PolySet *polyset, const Float20 &m, QString label);
 	CSGTerm(type_e type, CSGTerm *left, CSGTerm *right);
 
-	CSGTerm *normalize();
-	CSGTerm *normalize_tail();
-
 	CSGTerm *link();
 	void unlink();
 	QString dump();
 };
 
+/*!
+	Normalizes CSG terms to sums of products. Every term created on the
+	way is hash-consed by (type, left, right) and owned by the normalizer
+	until it is destroyed, so identical sub-terms are normalized once and
+	duplicated products are shared instead of copied. Operands whose
+	bounding boxes show that they can't contribute are dropped.
+*/
+class CSGNormalizer
+{
+public:
+	CSGNormalizer(int max_elements);
+	~CSGNormalizer();
+
+	CSGTerm *normalize(CSGTerm *term);
+	bool exceeded;
+
+private:
+	typedef QPair<QPair<int, CSGTerm*>, CSGTerm*> cons_key_t;
+
+	int max_elements;
+	CSGTerm *empty;
+	QHash<cons_key_t, CSGTerm*> terms;
+	QHash<CSGTerm*, CSGTerm*> normalized;
+	QHash<CSGTerm*, int> elements;
+
+	CSGTerm *mk(CSGTerm::type_e type, CSGTerm *left, CSGTerm *right);
+	CSGTerm *norm(CSGTerm *term);
+	CSGTerm *rewrite(CSGTerm *term);
+	int count(CSGTerm *term);
+};
+
+/*!
+	Flat rendering chain of a normalized term. Each primitive is one record
+	in a contiguous array, holding everything the previews need per frame,
+	so drawing a chain walks memory linearly. Labels are only needed for
+	dumps and are kept apart.
+*/
 class CSGChain
 {
 public:
-	QVector<PolySet*> polysets;
-	QVector<Float20Ptr> matrices;
-	QVector<CSGTerm::type_e> types;
+	struct Element {
+		PolySet *polyset;
+		boost::array<float, 16> m;
+		boost::array<float, 4> color;  // all negative if none was given
+		bool mirrored;
+		unsigned char type;  // CSGTerm::type_e
+
+		bool has_color() const {
+			return color[0] >= 0 || color[1] >= 0 || color[2] >= 0 || color[3] >= 0;
+		}
+	};
+
+	std::vector<Element> elements;
 	QVector<QString> labels;
 
 	CSGChain();
 
+	int size() const { return elements.size(); }
 	void add(PolySet *polyset, const Float20 &m, CSGTerm::type_e type, QString label);
 	void import(CSGTerm *term, CSGTerm::type_e type = CSGTerm::TYPE_UNION);
 	QString dump();
+
+private:
+	static int count(CSGTerm *term);
+	void append(CSGTerm *term, CSGTerm::type_e type);
 };
 
 #endif
@@ -35,13 +35,13 @@
 #include <QVector>
 #include "mathc99.h"
 #include <assert.h>
+#include <algorithm>
 
 struct Line {
-	typedef DxfData::Point Point;
-	Point *p[2];
+	int p[2];  // indices into DxfData::points
 	bool disabled;
-	Line(Point *p1, Point *p2) { p[0] = p1; p[1] = p2; disabled = false; }
-	Line() { p[0] = NULL; p[1] = NULL; disabled = false; }
+	Line(int p1, int p2) { p[0] = p1; p[1] = p2; disabled = false; }
+	Line() { p[0] = -1; p[1] = -1; disabled = false; }
 };
 
 DxfData::DxfData()
@@ -238,10 +238,12 @@ DxfData::DxfData(const Accuracy &acc, const QString &filename, const QString &la
 				int n = blockdata[iddata].size();
 				for (int i = 0; i < n; i++) {
 					double a = arc_start_angle * M_PI / 180.0;
-					double lx1 = blockdata[iddata][i].p[0]->x * ellipse_start_angle;
-					double ly1 = blockdata[iddata][i].p[0]->y * ellipse_stop_angle;
-					double lx2 = blockdata[iddata][i].p[1]->x * ellipse_start_angle;
-					double ly2 = blockdata[iddata][i].p[1]->y * ellipse_stop_angle;
+					const Point &l1 = this->points[blockdata[iddata][i].p[0]];
+					const Point &l2 = this->points[blockdata[iddata][i].p[1]];
+					double lx1 = l1.x * ellipse_start_angle;
+					double ly1 = l1.y * ellipse_stop_angle;
+					double lx2 = l2.x * ellipse_start_angle;
+					double ly2 = l2.y * ellipse_stop_angle;
 					double px1 = (cos(a)*lx1 - sin(a)*ly1) * scale + xverts[0];
 					double py1 = (sin(a)*lx1 + cos(a)*ly1) * scale + yverts[0];
 					double px2 = (cos(a)*lx2 - sin(a)*ly2) * scale + xverts[0];
@@ -381,7 +383,8 @@ DxfData::DxfData(const Accuracy &acc, const QString &filename, const QString &la
 
 		foreach (int i, enabled_lines) {
 			for (int j = 0; j < 2; j++) {
-				QVector<int> *lv = &grid.data(lines[i].p[j]->x, lines[i].p[j]->y);
+				const Point &p = this->points[lines[i].p[j]];
+				QVector<int> *lv = &grid.data(p.x, p.y);
 				for (int ki = 0; ki < lv->count(); ki++) {
 					int k = lv->at(ki);
 					if (k == i || lines[k].disabled)
@@ -398,26 +401,27 @@ DxfData::DxfData(const Accuracy &acc, const QString &filename, const QString &la
 		break;
 
 	create_open_path:
-		this->paths.append(Path());
-		Path *this_path = &this->paths.last();
+		this->paths.push_back(Path());
+		Path *this_path = &this->paths.back();
 
-		this_path->points.append(lines[current_line].p[current_point]);
+		this_path->indices.push_back(lines[current_line].p[current_point]);
 		while (1) {
-			this_path->points.append(lines[current_line].p[!current_point]);
-			Point *ref_point = lines[current_line].p[!current_point];
+			this_path->indices.push_back(lines[current_line].p[!current_point]);
+			Point ref_point = this->points[lines[current_line].p[!current_point]];
 			lines[current_line].disabled = true;
 			enabled_lines.remove(current_line);
-			QVector<int> *lv = &grid.data(ref_point->x, ref_point->y);
+			QVector<int> *lv = &grid.data(ref_point.x, ref_point.y);
 			for (int ki = 0; ki < lv->count(); ki++) {
 				int k = lv->at(ki);
 				if (lines[k].disabled)
 					continue;
-				if (grid.eq(ref_point->x, ref_point->y, lines[k].p[0]->x, lines[k].p[0]->y)) {
+				const Point &k0 = this->points[lines[k].p[0]], &k1 = this->points[lines[k].p[1]];
+				if (grid.eq(ref_point.x, ref_point.y, k0.x, k0.y)) {
 					current_line = k;
 					current_point = 0;
 					goto found_next_line_in_open_path;
 				}
-				if (grid.eq(ref_point->x, ref_point->y, lines[k].p[1]->x, lines[k].p[1]->y)) {
+				if (grid.eq(ref_point.x, ref_point.y, k1.x, k1.y)) {
 					current_line = k;
 					current_point = 1;
 					goto found_next_line_in_open_path;
@@ -433,27 +437,28 @@ DxfData::DxfData(const Accuracy &acc, const QString &filename, const QString &la
 	{
 		int current_line = enabled_lines.begin().value(), current_point = 0;
 
-		this->paths.append(Path());
-		Path *this_path = &this->paths.last();
+		this->paths.push_back(Path());
+		Path *this_path = &this->paths.back();
 		this_path->is_closed = true;
 		
-		this_path->points.append(lines[current_line].p[current_point]);
+		this_path->indices.push_back(lines[current_line].p[current_point]);
 		while (1) {
-			this_path->points.append(lines[current_line].p[!current_point]);
-			Point *ref_point = lines[current_line].p[!current_point];
+			this_path->indices.push_back(lines[current_line].p[!current_point]);
+			Point ref_point = this->points[lines[current_line].p[!current_point]];
 			lines[current_line].disabled = true;
 			enabled_lines.remove(current_line);
-			QVector<int> *lv = &grid.data(ref_point->x, ref_point->y);
+			QVector<int> *lv = &grid.data(ref_point.x, ref_point.y);
 			for (int ki = 0; ki < lv->count(); ki++) {
 				int k = lv->at(ki);
 				if (lines[k].disabled)
 					continue;
-				if (grid.eq(ref_point->x, ref_point->y, lines[k].p[0]->x, lines[k].p[0]->y)) {
+				const Point &k0 = this->points[lines[k].p[0]], &k1 = this->points[lines[k].p[1]];
+				if (grid.eq(ref_point.x, ref_point.y, k0.x, k0.y)) {
 					current_line = k;
 					current_point = 0;
 					goto found_next_line_in_closed_path;
 				}
-				if (grid.eq(ref_point->x, ref_point->y, lines[k].p[1]->x, lines[k].p[1]->y)) {
+				if (grid.eq(ref_point.x, ref_point.y, k1.x, k1.y)) {
 					current_line = k;
 					current_point = 1;
 					goto found_next_line_in_closed_path;
@@ -468,10 +473,10 @@ DxfData::DxfData(const Accuracy &acc, const QString &filename, const QString &la
 
 #if 0
 	printf("----- DXF Data -----\n");
-	for (int i = 0; i < this->paths.count(); i++) {
-		printf("Path %d (%s):\n", i, this->paths[i].is_closed ? "closed" : "open");
-		for (int j = 0; j < this->paths[i].points.count(); j++)
-			printf("  %f %f\n", this->paths[i].points[j]->x, this->paths[i].points[j]->y);
+	for (size_t i = 0; i < this->paths.size(); i++) {
+		printf("Path %d (%s):\n", (int)i, this->paths[i].is_closed ? "closed" : "open");
+		for (size_t j = 0; j < this->paths[i].indices.size(); j++)
+			printf("  %f %f\n", point(this->paths[i], j).x, point(this->paths[i], j).y);
 	}
 	printf("--------------------\n");
 	fflush(stdout);
@@ -484,26 +489,28 @@ DxfData::DxfData(const Accuracy &acc, const QString &filename, const QString &la
 */
 void DxfData::fixup_path_direction()
 {
-	for (int i = 0; i < this->paths.count(); i++) {
-		if (!this->paths[i].is_closed)
+	for (size_t i = 0; i < this->paths.size(); i++) {
+		Path &path = this->paths[i];
+		if (!path.is_closed)
 			break;
-		this->paths[i].is_inner = true;
-		double min_x = this->paths[i].points[0]->x;
+		path.is_inner = true;
+		int n = path.indices.size();
+		double min_x = point(path, 0).x;
 		int min_x_point = 0;
-		for (int j = 1; j < this->paths[i].points.count(); j++) {
-			if (this->paths[i].points[j]->x < min_x) {
-				min_x = this->paths[i].points[j]->x;
+		for (int j = 1; j < n; j++) {
+			if (point(path, j).x < min_x) {
+				min_x = point(path, j).x;
 				min_x_point = j;
 			}
 		}
 		// rotate points if the path is in non-standard rotation
 		int b = min_x_point;
-		int a = b == 0 ? this->paths[i].points.count() - 2 : b - 1;
-		int c = b == this->paths[i].points.count() - 1 ? 1 : b + 1;
-		double ax = this->paths[i].points[a]->x - this->paths[i].points[b]->x;
-		double ay = this->paths[i].points[a]->y - this->paths[i].points[b]->y;
-		double cx = this->paths[i].points[c]->x - this->paths[i].points[b]->x;
-		double cy = this->paths[i].points[c]->y - this->paths[i].points[b]->y;
+		int a = b == 0 ? n - 2 : b - 1;
+		int c = b == n - 1 ? 1 : b + 1;
+		double ax = point(path, a).x - point(path, b).x;
+		double ay = point(path, a).y - point(path, b).y;
+		double cx = point(path, c).x - point(path, b).x;
+		double cy = point(path, c).y - point(path, b).y;
 #if 0
 		printf("Rotate check:\n");
 		printf("  a/b/c indices = %d %d %d\n", a, b, c);
@@ -511,16 +518,16 @@ void DxfData::fixup_path_direction()
 		printf("  b->c vector = %f %f (%f)\n", cx, cy, atan2(cx, cy));
 #endif
 		// FIXME: atan2() usually takes y,x. This variant probably makes the path clockwise..
-		if (atan2(ax, ay) < atan2(cx, cy)) {
-			for (int j = 0; j < this->paths[i].points.count()/2; j++)
-				this->paths[i].points.swap(j, this->paths[i].points.count()-1-j);
-		}
+		if (atan2(ax, ay) < atan2(cx, cy))
+			std::reverse(path.indices.begin(), path.indices.end());
 	}
 }
 
-DxfData::Point *DxfData::addPoint(double x, double y)
+/*!
+	Appends a point and returns its index
+*/
+int DxfData::addPoint(double x, double y)
 {
-	this->points.append(Point(x, y));
-	return &this->points.last();
+	this->points.push_back(Point(x, y));
+	return this->points.size() - 1;
 }
-
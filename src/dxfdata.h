@@ -3,8 +3,14 @@
 
 #include <QList>
 #include <QString>
+#include <vector>
 #include "accuracy.h"
 
+/*!
+	2D paths read from DXF files or converted from 2D Nef polyhedra. All
+	points live in one contiguous array and paths refer to them by index,
+	so the array may grow and be copied without invalidating the paths.
+*/
 class DxfData
 {
 public:
@@ -14,7 +20,7 @@ public:
 		Point(double x, double y) : x(x), y(y) { }
 	};
 	struct Path {
-		QList<Point*> points;
+		std::vector<int> indices;  // into DxfData::points
 		bool is_closed, is_inner;
 		Path() : is_closed(false), is_inner(false) { }
 	};
@@ -34,8 +40,8 @@ public:
 		}
 	};
 
-	QList<Point> points;
-	QList<Path> paths;
+	std::vector<Point> points;
+	std::vector<Path> paths;
 	QList<Dim> dims;
 
 	DxfData();
@@ -44,7 +50,10 @@ public:
 	DxfData(const struct CGAL_Nef_polyhedron &N);
 #endif
 
-	Point *addPoint(double x, double y);
+	int addPoint(double x, double y);
+	const Point &point(const Path &path, int j) const {
+		return points[path.indices[j]];
+	}
 
 private:
 	void fixup_path_direction();
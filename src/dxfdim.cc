@@ -113,13 +113,13 @@ Float2 dxf_cross(const QString &filename, const QString &layername, Float2 origi
 
 	double coords[4][2];
 
-	for (int i = 0, j = 0; i < dxf.paths.count(); i++) {
-		if (dxf.paths[i].points.count() != 2)
+	for (int i = 0, j = 0; i < (int)dxf.paths.size(); i++) {
+		if (dxf.paths[i].indices.size() != 2)
 			continue;
-		coords[j][0] = dxf.paths[i].points[0]->x;
-		coords[j++][1] = dxf.paths[i].points[0]->y;
-		coords[j][0] = dxf.paths[i].points[1]->x;
-		coords[j++][1] = dxf.paths[i].points[1]->y;
+		coords[j][0] = dxf.point(dxf.paths[i], 0).x;
+		coords[j++][1] = dxf.point(dxf.paths[i], 0).y;
+		coords[j][0] = dxf.point(dxf.paths[i], 1).x;
+		coords[j++][1] = dxf.point(dxf.paths[i], 1).y;
 
 		if (j == 4) {
 			double x1 = coords[0][0], y1 = coords[0][1];
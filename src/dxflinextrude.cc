@@ -29,6 +29,7 @@
 #include "dxfdata.h"
 #include "dxftess.h"
 #include "polyset.h"
+#include "grid.h"
 #include "progress.h"
 #include "openscad.h" // get_fragments_from_r()
 
@@ -48,109 +49,131 @@ DxfLinearExtrudeNode::DxfLinearExtrudeNode(const AbstractNode::NodeList &childre
 }
 
 
-static void add_slice(PolySet *ps, DxfData::Path *pt, double rot1, double rot2, double h1, double h2)
-{
-	for (int j = 1; j < pt->points.count(); j++)
-	{
-		int k = j - 1;
-
-		double jx1 = pt->points[j]->x *  cos(rot1*M_PI/180) + pt->points[j]->y * sin(rot1*M_PI/180);
-		double jy1 = pt->points[j]->x * -sin(rot1*M_PI/180) + pt->points[j]->y * cos(rot1*M_PI/180);
+/*!
+	A closed path of the cross-section, stored as a contiguous run of
+	vertices in the ring buffers (the duplicated closing point is dropped).
+*/
+struct extrude_path_t {
+	int first, count;
+	bool is_inner;
+	extrude_path_t(int first, int count, bool is_inner) :
+			first(first), count(count), is_inner(is_inner) { }
+	extrude_path_t() : first(0), count(0), is_inner(false) { }
+};
 
-		double jx2 = pt->points[j]->x *  cos(rot2*M_PI/180) + pt->points[j]->y * sin(rot2*M_PI/180);
-		double jy2 = pt->points[j]->x * -sin(rot2*M_PI/180) + pt->points[j]->y * cos(rot2*M_PI/180);
+static void add_triangle(PolySet *ps, int a, int b, int c)
+{
+	if (a == b || b == c || c == a)
+		return;
+	ps->append_triangle(a, b, c);
+}
 
-		double kx1 = pt->points[k]->x *  cos(rot1*M_PI/180) + pt->points[k]->y * sin(rot1*M_PI/180);
-		double ky1 = pt->points[k]->x * -sin(rot1*M_PI/180) + pt->points[k]->y * cos(rot1*M_PI/180);
+static void add_slice(PolySet *ps, const QVector<extrude_path_t> &paths,
+		const PolySet::Point *r1, const PolySet::Point *r2,
+		const int *i1, const int *i2)
+{
+	for (int i = 0; i < paths.size(); i++)
+	{
+		const extrude_path_t &pt = paths[i];
+		for (int j = 0; j < pt.count; j++)
+		{
+			int k = (j + pt.count - 1) % pt.count;
 
-		double kx2 = pt->points[k]->x *  cos(rot2*M_PI/180) + pt->points[k]->y * sin(rot2*M_PI/180);
-		double ky2 = pt->points[k]->x * -sin(rot2*M_PI/180) + pt->points[k]->y * cos(rot2*M_PI/180);
+			const PolySet::Point &j1 = r1[pt.first + j], &j2 = r2[pt.first + j];
+			const PolySet::Point &k1 = r1[pt.first + k], &k2 = r2[pt.first + k];
+			int vj1 = i1[pt.first + j], vj2 = i2[pt.first + j];
+			int vk1 = i1[pt.first + k], vk2 = i2[pt.first + k];
 
-		double dia1_len_sq = (jy1-ky2)*(jy1-ky2) + (jx1-kx2)*(jx1-kx2);
-		double dia2_len_sq = (jy2-ky1)*(jy2-ky1) + (jx2-kx1)*(jx2-kx1);
+			double dia1_len_sq = (j1.y-k2.y)*(j1.y-k2.y) + (j1.x-k2.x)*(j1.x-k2.x);
+			double dia2_len_sq = (j2.y-k1.y)*(j2.y-k1.y) + (j2.x-k1.x)*(j2.x-k1.x);
 
-		if (dia1_len_sq > dia2_len_sq)
-		{
-			ps->append_poly();
-			if (pt->is_inner) {
-				ps->append_vertex(kx1, ky1, h1);
-				ps->append_vertex(jx1, jy1, h1);
-				ps->append_vertex(jx2, jy2, h2);
-			} else {
-				ps->insert_vertex(kx1, ky1, h1);
-				ps->insert_vertex(jx1, jy1, h1);
-				ps->insert_vertex(jx2, jy2, h2);
+			if (dia1_len_sq > dia2_len_sq)
+			{
+				if (pt.is_inner) {
+					add_triangle(ps, vk1, vj1, vj2);
+					add_triangle(ps, vk2, vk1, vj2);
+				} else {
+					add_triangle(ps, vj2, vj1, vk1);
+					add_triangle(ps, vj2, vk1, vk2);
+				}
 			}
-
-			ps->append_poly();
-			if (pt->is_inner) {
-				ps->append_vertex(kx2, ky2, h2);
-				ps->append_vertex(kx1, ky1, h1);
-				ps->append_vertex(jx2, jy2, h2);
-			} else {
-				ps->insert_vertex(kx2, ky2, h2);
-				ps->insert_vertex(kx1, ky1, h1);
-				ps->insert_vertex(jx2, jy2, h2);
+			else
+			{
+				if (pt.is_inner) {
+					add_triangle(ps, vk1, vj1, vk2);
+					add_triangle(ps, vj2, vk2, vj1);
+				} else {
+					add_triangle(ps, vk2, vj1, vk1);
+					add_triangle(ps, vj1, vk2, vj2);
+				}
 			}
 		}
-		else
-		{
-			ps->append_poly();
-			if (pt->is_inner) {
-				ps->append_vertex(kx1, ky1, h1);
-				ps->append_vertex(jx1, jy1, h1);
-				ps->append_vertex(kx2, ky2, h2);
-			} else {
-				ps->insert_vertex(kx1, ky1, h1);
-				ps->insert_vertex(jx1, jy1, h1);
-				ps->insert_vertex(kx2, ky2, h2);
-			}
+	}
+}
 
-			ps->append_poly();
-			if (pt->is_inner) {
-				ps->append_vertex(jx2, jy2, h2);
-				ps->append_vertex(kx2, ky2, h2);
-				ps->append_vertex(jx1, jy1, h1);
-			} else {
-				ps->insert_vertex(jx2, jy2, h2);
-				ps->insert_vertex(kx2, ky2, h2);
-				ps->insert_vertex(jx1, jy1, h1);
-			}
-		}
+/*!
+	Rotates the cross-section to one slice boundary and adds the ring to
+	the PolySet, so that both adjacent slices share its vertices.
+*/
+static void rotate_ring(PolySet *ps, QVector<PolySet::Point> &ring, QVector<int> &idx,
+		const QVector<PolySet::Point> &base, double c, double s, double h)
+{
+	const PolySet::Point *src = base.constData();
+	PolySet::Point *dst = ring.data();
+	for (int i = 0; i < base.size(); i++) {
+		dst[i].x = src[i].x *  c + src[i].y * s;
+		dst[i].y = src[i].x * -s + src[i].y * c;
+		dst[i].z = h;
+		idx[i] = ps->add_vertex(dst[i].x, dst[i].y, dst[i].z);
 	}
 }
 
-PolySet *DxfLinearExtrudeNode::render_polyset(render_mode_e) const
+PolySet *DxfLinearExtrudeNode::render_polyset(render_mode_e mode) const
 {
-  double slices = this->slices;
-  if (has_twist && slices<2) {
-	  slices = (int)std::max(2.0, std::abs(get_fragments_from_r(height, *this) * twist / 360));
-  }  
+	int slices = 1;
+	if (has_twist) {
+		slices = this->slices;
+		if (slices < 2)
+			slices = (int)std::max(2.0, std::abs(get_fragments_from_r(height, *this) * twist / 360));
+	}
 	QString key = mk_cache_id();
 	if (PolySet::ps_cache.contains(key)) {
 		PRINT(PolySet::ps_cache[key]->msg);
 		return PolySet::ps_cache[key]->ps->link();
 	}
+	QString preview_key = QString("preview:") + key;
+	if (mode == RENDER_OPENCSG && PolySet::ps_cache.contains(preview_key)) {
+		PRINT(PolySet::ps_cache[preview_key]->msg);
+		return PolySet::ps_cache[preview_key]->ps->link();
+	}
 
 	print_messages_push();
 	DxfData *dxf;
 	
 	if (filename.isEmpty()) {
 #ifdef ENABLE_CGAL
-	  // Before extruding, union all (2D) children nodes
-	  // to a single DxfData, then tesselate this into a PolySet
-	  CGAL_Nef_polyhedron N;
-	  N.dim = 2;
-	  foreach(AbstractNode::Pointer v, children) {
-		  if (v->props.background)
-			  continue;
-		  N.p2 += v->render_cgal_nef_polyhedron().p2;
+	  // Previews don't need the exact union of the 2D children
+	  // as long as they don't overlap
+	  if (mode == RENDER_OPENCSG && (dxf = dxf_flatten_children(*this)) != NULL) {
+		  key = preview_key;
+	  } else {
+		  // Before extruding, union all (2D) children nodes
+		  // to a single DxfData, then tesselate this into a PolySet
+		  CGAL_Nef_polyhedron N = CGAL_Nef_polyhedron2();
+		  foreach(AbstractNode::Pointer v, children) {
+			  if (v->props.background)
+				  continue;
+			  N += v->render_cgal_nef_polyhedron();
+		  }
+		  dxf = new DxfData(N);
 	  }
-	  dxf = new DxfData(N);
 
 #else // ENABLE_CGAL
-	  PRINT("WARNING: Found linear_extrude() statement without dxf file but compiled without CGAL support!");
-	  dxf = new DxfData();
+	  dxf = dxf_flatten_children(*this);
+	  if (!dxf) {
+		  PRINT("WARNING: Found linear_extrude() statement with overlapping children but compiled without CGAL support!");
+		  dxf = new DxfData();
+	  }
 #endif // ENABLE_CGAL
 	} else {
 	  dxf = new DxfData(*this, filename, layername, origin[0], origin[1], scale);
@@ -169,9 +192,10 @@ PolySet *DxfLinearExtrudeNode::render_polyset(render_mode_e) const
 	}
 
 	bool first_open_path = true;
-	for (int i = 0; i < dxf->paths.count(); i++)
+	for (size_t i = 0; i < dxf->paths.size(); i++)
 	{
-		if (dxf->paths[i].is_closed)
+		const DxfData::Path &path = dxf->paths[i];
+		if (path.is_closed)
 			continue;
 		if (first_open_path) {
 			PRINTF("WARING: Open paths in dxf_liniear_extrude(file = \"%s\", layer = \"%s\"):",
@@ -179,42 +203,88 @@ PolySet *DxfLinearExtrudeNode::render_polyset(render_mode_e) const
 			first_open_path = false;
 		}
 		PRINTF("   %9.5f %10.5f ... %10.5f %10.5f",
-				dxf->paths[i].points.first()->x / scale + origin[0],
-				dxf->paths[i].points.first()->y / scale + origin[1], 
-				dxf->paths[i].points.last()->x / scale + origin[0],
-				dxf->paths[i].points.last()->y / scale + origin[1]);
+				dxf->points[path.indices.front()].x / scale + origin[0],
+				dxf->points[path.indices.front()].y / scale + origin[1], 
+				dxf->points[path.indices.back()].x / scale + origin[0],
+				dxf->points[path.indices.back()].y / scale + origin[1]);
 	}
 
+	// Triangulate the cross-section only once. This also sets the is_inner
+	// flags of the paths which are needed for orienting the side walls.
+	PolySet *cap = new PolySet();
+	dxf_tesselate(cap, dxf, 0, true, true, 0);
 
-	if (has_twist)
+	// Collect the closed paths into one contiguous vertex array
+	QVector<PolySet::Point> base;
+	QVector<extrude_path_t> paths;
+	Grid2d<int> lookup(GRID_FINE);
+	base.reserve(dxf->points.size());
+	for (size_t i = 0; i < dxf->paths.size(); i++)
 	{
-		dxf_tesselate(ps, dxf, 0, false, true, h1);
-		dxf_tesselate(ps, dxf, twist, true, true, h2);
-		for (int j = 0; j < slices; j++)
-		{
-			double t1 = twist*j / slices;
-			double t2 = twist*(j+1) / slices;
-			double g1 = h1 + (h2-h1)*j / slices;
-			double g2 = h1 + (h2-h1)*(j+1) / slices;
-			for (int i = 0; i < dxf->paths.count(); i++)
-			{
-				if (!dxf->paths[i].is_closed)
-					continue;
-				add_slice(ps, &dxf->paths[i], t1, t2, g1, g2);
-			}
+		const DxfData::Path &path = dxf->paths[i];
+		int n = path.indices.size();
+		if (!path.is_closed || n < 2)
+			continue;
+		paths.append(extrude_path_t(base.size(), n - 1, path.is_inner));
+		for (int j = 1; j < n; j++) {
+			const DxfData::Point &p = dxf->point(path, j);
+			double x = p.x, y = p.y;
+			if (!lookup.has(x, y))
+				lookup.align(x, y) = base.size();
+			base.append(PolySet::Point(p.x, p.y, 0));
 		}
 	}
-	else
+
+	// Map the cap triangles to indices into the vertex array. Vertices the
+	// tesselator made up on its own are appended to the array as well.
+	QVector<int> cap_idx;
+	cap_idx.reserve(cap->polygons.size() * 3);
+	for (int i = 0; i < cap->polygons.size(); i++)
 	{
-		dxf_tesselate(ps, dxf, 0, false, true, h1);
-		dxf_tesselate(ps, dxf, 0, true, true, h2);
-		for (int i = 0; i < dxf->paths.count(); i++)
-		{
-			if (!dxf->paths[i].is_closed)
-				continue;
-			add_slice(ps, &dxf->paths[i], 0, 0, h1, h2);
+		if (cap->polygons[i].size() != 3)
+			continue;
+		for (int j = 0; j < 3; j++) {
+			double x = cap->polygons[i][j].x, y = cap->polygons[i][j].y;
+			if (!lookup.has(x, y)) {
+				lookup.align(x, y) = base.size();
+				base.append(PolySet::Point(cap->polygons[i][j].x, cap->polygons[i][j].y, 0));
+			}
+			cap_idx.append(lookup.data(x, y));
 		}
 	}
+	cap->unlink();
+
+	// Rotation table, one entry per slice boundary
+	QVector<double> rot_cos(slices + 1), rot_sin(slices + 1);
+	for (int j = 0; j <= slices; j++) {
+		double t = twist*j / slices;
+		rot_cos[j] = cos(t*M_PI/180);
+		rot_sin[j] = sin(t*M_PI/180);
+	}
+
+	QVector<PolySet::Point> ring_a(base.size()), ring_b(base.size());
+	QVector<PolySet::Point> *ring1 = &ring_a, *ring2 = &ring_b;
+	QVector<int> idx_a(base.size()), idx_b(base.size());
+	QVector<int> *idx1 = &idx_a, *idx2 = &idx_b;
+	rotate_ring(ps, *ring1, *idx1, base, rot_cos[0], rot_sin[0], h1);
+
+	// bottom cap, facing down
+	for (int i = 0; i < cap_idx.size(); i += 3)
+		add_triangle(ps, (*idx1)[cap_idx[i+2]], (*idx1)[cap_idx[i+1]], (*idx1)[cap_idx[i]]);
+
+	for (int j = 0; j < slices; j++)
+	{
+		double g2 = h1 + (h2-h1)*(j+1) / slices;
+		rotate_ring(ps, *ring2, *idx2, base, rot_cos[j+1], rot_sin[j+1], g2);
+		add_slice(ps, paths, ring1->constData(), ring2->constData(),
+				idx1->constData(), idx2->constData());
+		std::swap(ring1, ring2);
+		std::swap(idx1, idx2);
+	}
+
+	// top cap, facing up
+	for (int i = 0; i < cap_idx.size(); i += 3)
+		add_triangle(ps, (*idx1)[cap_idx[i]], (*idx1)[cap_idx[i+1]], (*idx1)[cap_idx[i+2]]);
 
 	PolySet::ps_cache.insert(key, new PolySet::ps_cache_entry(ps->link()));
 	print_messages_pop();
@@ -223,29 +293,22 @@ PolySet *DxfLinearExtrudeNode::render_polyset(render_mode_e) const
 	return ps;
 }
 
-QString DxfLinearExtrudeNode::dump(QString indent) const
+void DxfLinearExtrudeNode::dump_statement(QTextStream &out) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text;
-		QFileInfo fileInfo(filename);
-		text.sprintf("linear_extrude(file = \"%s\", cache = \"%x.%x\", layer = \"%s\", "
-				"height = %g, origin = [ %g %g ], scale = %g, center = %s, convexity = %d",
-				filename.toAscii().data(), (int)fileInfo.lastModified().toTime_t(), 
-				(int)fileInfo.size(), layername.toAscii().data(), height, origin[0], 
-				origin[1], scale, center ? "true" : "false", convexity);
-		if (has_twist) {
-			QString t2;
-			t2.sprintf(", twist = %g, slices = %d", twist, slices);
-			text += t2;
-		}
-		QString t3;
-		t3.sprintf(", $fn = %g, $fa = %g, $fs = %g) {\n", fn, fa, fs);
-		text += t3;
-		foreach (AbstractNode::Pointer v, children)
-			text += v->dump(indent + QString("\t"));
-		text += indent + "}\n";
-		((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
+	QString text;
+	QFileInfo fileInfo(filename);
+	text.sprintf("linear_extrude(file = \"%s\", cache = \"%x.%x\", layer = \"%s\", "
+			"height = %g, origin = [ %g %g ], scale = %g, center = %s, convexity = %d",
+			filename.toAscii().data(), (int)fileInfo.lastModified().toTime_t(), 
+			(int)fileInfo.size(), layername.toAscii().data(), height, origin[0], 
+			origin[1], scale, center ? "true" : "false", convexity);
+	if (has_twist) {
+		QString t2;
+		t2.sprintf(", twist = %g, slices = %d", twist, slices);
+		text += t2;
 	}
-	return dump_cache;
+	QString t3;
+	t3.sprintf(", $fn = %g, $fa = %g, $fs = %g)", fn, fa, fs);
+	out << text << t3;
 }
 
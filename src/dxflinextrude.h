@@ -44,7 +44,10 @@ public:
 			     double height, double twist, Float2 origin, double scale, 
 			     int convexity, int slices=-1, bool center=false, const Accuracy &acc=Accuracy(), const Props p=Props());
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+		return clone_as(this, children);
+	}
 };
 
 
@@ -29,6 +29,8 @@
 #include "printutils.h"
 #include "polyset.h"
 #include "dxfdata.h"
+#include "dxftess.h"
+#include "grid.h"
 #include "progress.h"
 #include "openscad.h" // get_fragments_from_r()
 
@@ -39,13 +41,38 @@
 #include <QFileInfo>
 #include <boost/make_shared.hpp>
 
-PolySet *DxfRotateExtrudeNode::render_polyset(render_mode_e) const
+/*!
+	A path of the profile as a run of indices into the profile vertex array.
+	Closed paths drop their duplicated closing point, open paths are
+	wrapped around like closed ones.
+*/
+struct rotextrude_path_t {
+	int first, count;
+	bool is_inner;
+	rotextrude_path_t(int first, int count, bool is_inner) :
+			first(first), count(count), is_inner(is_inner) { }
+	rotextrude_path_t() : first(0), count(0), is_inner(false) { }
+};
+
+static void add_triangle(PolySet *ps, int first, int a, int b, int c)
+{
+	if (a == b || b == c || c == a)
+		return;
+	ps->append_triangle(first + a, first + b, first + c);
+}
+
+PolySet *DxfRotateExtrudeNode::render_polyset(render_mode_e mode) const
 {
 	QString key = mk_cache_id();
 	if (PolySet::ps_cache.contains(key)) {
 		PRINT(PolySet::ps_cache[key]->msg);
 		return PolySet::ps_cache[key]->ps->link();
 	}
+	QString preview_key = QString("preview:") + key;
+	if (mode == RENDER_OPENCSG && PolySet::ps_cache.contains(preview_key)) {
+		PRINT(PolySet::ps_cache[preview_key]->msg);
+		return PolySet::ps_cache[preview_key]->ps->link();
+	}
 
 	print_messages_push();
 	DxfData *dxf;
@@ -53,18 +80,26 @@ PolySet *DxfRotateExtrudeNode::render_polyset(render_mode_e) const
 	if (filename.isEmpty())
 	{
 #ifdef ENABLE_CGAL
-		CGAL_Nef_polyhedron N;
-		N.dim = 2;
-		foreach(AbstractNode::Pointer v, children) {
-			if (v->props.background)
-				continue;
-			N.p2 += v->render_cgal_nef_polyhedron().p2;
+		// Previews don't need the exact union of the 2D children
+		// as long as they don't overlap
+		if (mode == RENDER_OPENCSG && (dxf = dxf_flatten_children(*this)) != NULL) {
+			key = preview_key;
+		} else {
+			CGAL_Nef_polyhedron N = CGAL_Nef_polyhedron2();
+			foreach(AbstractNode::Pointer v, children) {
+				if (v->props.background)
+					continue;
+				N += v->render_cgal_nef_polyhedron();
+			}
+			dxf = new DxfData(N);
 		}
-		dxf = new DxfData(N);
 
 #else // ENABLE_CGAL
-		PRINT("WARNING: Found rotate_extrude() statement without dxf file but compiled without CGAL support!");
-		dxf = new DxfData();
+		dxf = dxf_flatten_children(*this);
+		if (!dxf) {
+			PRINT("WARNING: Found rotate_extrude() statement with overlapping children but compiled without CGAL support!");
+			dxf = new DxfData();
+		}
 #endif // ENABLE_CGAL
 	} else {
 		dxf = new DxfData(*this, filename, layername, origin[0], origin[1], scale);
@@ -73,73 +108,133 @@ PolySet *DxfRotateExtrudeNode::render_polyset(render_mode_e) const
 	PolySet *ps = new PolySet();
 	ps->convexity = convexity;
 
-	for (int i = 0; i < dxf->paths.count(); i++)
+	bool full_sweep = angle >= 360.0;
+	if (angle <= 0.0) {
+		PRINTF("WARNING: Invalid angle %g in rotate_extrude(), doing a full revolution.", angle);
+		full_sweep = true;
+	}
+
+	// Collect the unique profile vertices and the paths indexing them
+	QVector<PolySet::Point> base;
+	QVector<int> path_idx;
+	QVector<rotextrude_path_t> paths;
+	Grid2d<int> lookup(GRID_FINE);
+	double max_x = 0;
+	path_idx.reserve(dxf->points.size());
+	for (size_t i = 0; i < dxf->paths.size(); i++)
 	{
-		double max_x = 0;
-		for (int j = 0; j < dxf->paths[i].points.count(); j++) {
-			max_x = fmax(max_x, dxf->paths[i].points[j]->x);
+		const DxfData::Path &path = dxf->paths[i];
+		int start = path.is_closed ? 1 : 0;
+		int n = path.indices.size();
+		if (n - start < 2)
+			continue;
+		paths.append(rotextrude_path_t(path_idx.size(), n - start, false));
+		for (int j = start; j < n; j++) {
+			const DxfData::Point &p = dxf->point(path, j);
+			double x = p.x, y = p.y;
+			max_x = fmax(max_x, x);
+			if (!lookup.has(x, y)) {
+				lookup.align(x, y) = base.size();
+				base.append(PolySet::Point(p.x, 0, p.y));
+			}
+			path_idx.append(lookup.data(x, y));
 		}
+	}
 
-		int fragments = get_fragments_from_r(max_x, *this);
-
-        double ***points;
-        points = new double**[fragments];
-        for (int j=0; j < fragments; j++) {
-            points[j] = new double*[dxf->paths[i].points.count()];
-            for (int k=0; k < dxf->paths[i].points.count(); k++)
-                points[j][k] = new double[3];
-        }
-
-		for (int j = 0; j < fragments; j++) {
-			double a = (j*2*M_PI) / fragments;
-			for (int k = 0; k < dxf->paths[i].points.count(); k++) {
-				if (dxf->paths[i].points[k]->x == 0) {
-					points[j][k][0] = 0;
-					points[j][k][1] = 0;
-				} else {
-					points[j][k][0] = dxf->paths[i].points[k]->x * sin(a);
-					points[j][k][1] = dxf->paths[i].points[k]->x * cos(a);
+	// A partial sweep is closed by the profile itself at both ends. The
+	// tesselator also tells us the orientation of the paths, which the side
+	// walls need to follow for the caps to fit.
+	QVector<int> cap_idx;
+	if (!full_sweep)
+	{
+		PolySet *cap = new PolySet();
+		dxf_tesselate(cap, dxf, 0, true, true, 0);
+		for (int i = 0, n = 0; i < (int)dxf->paths.size(); i++) {
+			const DxfData::Path &path = dxf->paths[i];
+			if ((int)path.indices.size() - (path.is_closed ? 1 : 0) < 2)
+				continue;
+			paths[n++].is_inner = path.is_closed && path.is_inner;
+		}
+		for (int i = 0; i < cap->polygons.size(); i++) {
+			if (cap->polygons[i].size() != 3)
+				continue;
+			for (int j = 0; j < 3; j++) {
+				double x = cap->polygons[i][j].x, y = cap->polygons[i][j].y;
+				if (!lookup.has(x, y)) {
+					lookup.align(x, y) = base.size();
+					base.append(PolySet::Point(cap->polygons[i][j].x, 0, cap->polygons[i][j].y));
 				}
-				points[j][k][2] = dxf->paths[i].points[k]->y;
+				cap_idx.append(lookup.data(x, y));
 			}
 		}
+		cap->unlink();
+	}
 
-		for (int j = 0; j < fragments; j++) {
-			int j1 = j + 1 < fragments ? j + 1 : 0;
-			for (int k = 0; k < dxf->paths[i].points.count(); k++) {
-				int k1 = k + 1 < dxf->paths[i].points.count() ? k + 1 : 0;
-				if (points[j][k][0] != points[j1][k][0] ||
-						points[j][k][1] != points[j1][k][1] ||
-						points[j][k][2] != points[j1][k][2]) {
-					ps->append_poly();
-					ps->append_vertex(points[j ][k ][0],
-							points[j ][k ][1], points[j ][k ][2]);
-					ps->append_vertex(points[j1][k ][0],
-							points[j1][k ][1], points[j1][k ][2]);
-					ps->append_vertex(points[j ][k1][0],
-							points[j ][k1][1], points[j ][k1][2]);
-				}
-				if (points[j][k1][0] != points[j1][k1][0] ||
-						points[j][k1][1] != points[j1][k1][1] ||
-						points[j][k1][2] != points[j1][k1][2]) {
-					ps->append_poly();
-					ps->append_vertex(points[j ][k1][0],
-							points[j ][k1][1], points[j ][k1][2]);
-					ps->append_vertex(points[j1][k ][0],
-							points[j1][k ][1], points[j1][k ][2]);
-					ps->append_vertex(points[j1][k1][0],
-							points[j1][k1][1], points[j1][k1][2]);
+	int fragments = get_fragments_from_r(max_x, *this);
+	if (!full_sweep)
+		fragments = (int)std::max(1.0, ceil(fragments * angle / 360.0));
+
+	// Angle table shared by all paths. For a full revolution the second half
+	// mirrors the first one, and the last ring wraps around to the first.
+	int rings = full_sweep ? fragments : fragments + 1;
+	QVector<double> ring_sin(rings), ring_cos(rings);
+	for (int j = 0; j < rings; j++) {
+		if (full_sweep && 2*j > fragments) {
+			ring_sin[j] = -ring_sin[fragments - j];
+			ring_cos[j] = ring_cos[fragments - j];
+			continue;
+		}
+		double a = full_sweep ? (j*2*M_PI) / fragments : (j*angle*M_PI/180) / fragments;
+		ring_sin[j] = sin(a);
+		ring_cos[j] = cos(a);
+	}
+
+	// One ring of profile vertices per angle, starting at vertex 'verts' of
+	// the PolySet. Vertices on the rotation axis are shared by all rings and
+	// live in ring 0.
+	int nbase = base.size();
+	int verts = ps->vertex_count();
+	for (int j = 0; j < rings; j++) {
+		for (int k = 0; k < nbase; k++) {
+			if (base[k].x == 0)
+				ps->add_vertex(PolySet::Point(0, 0, base[k].z));
+			else
+				ps->add_vertex(PolySet::Point(base[k].x * ring_sin[j], base[k].x * ring_cos[j], base[k].z));
+		}
+	}
+#define RING_VERTEX(_j, _k) (base[_k].x == 0 ? (_k) : (_j)*nbase + (_k))
+
+	for (int i = 0; i < paths.size(); i++)
+	{
+		const rotextrude_path_t &pt = paths[i];
+		for (int j = 0; j < fragments; j++)
+		{
+			int j1 = j + 1 < rings ? j + 1 : 0;
+			for (int k = 0; k < pt.count; k++)
+			{
+				int k1 = k + 1 < pt.count ? k + 1 : 0;
+				int p = path_idx[pt.first + k], p1 = path_idx[pt.first + k1];
+				int a = RING_VERTEX(j, p), b = RING_VERTEX(j1, p);
+				int c = RING_VERTEX(j, p1), d = RING_VERTEX(j1, p1);
+				if (pt.is_inner) {
+					add_triangle(ps, verts, a, c, b);
+					add_triangle(ps, verts, c, d, b);
+				} else {
+					add_triangle(ps, verts, a, b, c);
+					add_triangle(ps, verts, c, b, d);
 				}
 			}
 		}
+	}
 
-        for (int j=0; j < fragments; j++) {
-            for (int k=0; k < dxf->paths[i].points.count(); k++)
-                delete[] points[j][k];
-            delete[] points[j];
-        }
-        delete[] points;
+	// start cap facing against the sweep direction, end cap facing along it
+	for (int i = 0; i < cap_idx.size(); i += 3) {
+		add_triangle(ps, verts, RING_VERTEX(0, cap_idx[i+2]),
+				RING_VERTEX(0, cap_idx[i+1]), RING_VERTEX(0, cap_idx[i]));
+		add_triangle(ps, verts, RING_VERTEX(fragments, cap_idx[i]),
+				RING_VERTEX(fragments, cap_idx[i+1]), RING_VERTEX(fragments, cap_idx[i+2]));
 	}
+#undef RING_VERTEX
 
 	PolySet::ps_cache.insert(key, new PolySet::ps_cache_entry(ps->link()));
 	print_messages_pop();
@@ -148,22 +243,22 @@ PolySet *DxfRotateExtrudeNode::render_polyset(render_mode_e) const
 	return ps;
 }
 
-QString DxfRotateExtrudeNode::dump(QString indent) const
+void DxfRotateExtrudeNode::dump_statement(QTextStream &out) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text;
-		QFileInfo fileInfo(filename);
-		text.sprintf("rotate_extrude(file = \"%s\", cache = \"%x.%x\", layer = \"%s\", "
-				"origin = [ %g %g ], scale = %g, convexity = %d, "
-				"$fn = %g, $fa = %g, $fs = %g) {\n",
-				filename.toAscii().data(), (int)fileInfo.lastModified().toTime_t(),
-				(int)fileInfo.size(),layername.toAscii().data(), origin[0], origin[1], 
-				scale, convexity, fn, fa, fs);
-		foreach (AbstractNode::Pointer v, children)
-			text += v->dump(indent + QString("\t"));
-		text += indent + "}\n";
-		((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
+	QString text;
+	QFileInfo fileInfo(filename);
+	text.sprintf("rotate_extrude(file = \"%s\", cache = \"%x.%x\", layer = \"%s\", "
+			"origin = [ %g %g ], scale = %g, convexity = %d",
+			filename.toAscii().data(), (int)fileInfo.lastModified().toTime_t(),
+			(int)fileInfo.size(),layername.toAscii().data(), origin[0], origin[1], 
+			scale, convexity);
+	if (angle != 360.0) {
+		QString t2;
+		t2.sprintf(", angle = %g", angle);
+		text += t2;
 	}
-	return dump_cache;
+	QString t3;
+	t3.sprintf(", $fn = %g, $fa = %g, $fs = %g)", fn, fa, fs);
+	out << text << t3;
 }
 
@@ -35,16 +35,20 @@ class DxfRotateExtrudeNode : public AbstractPolyNode, public Accuracy
 public:
 	typedef shared_ptr<DxfRotateExtrudeNode> Pointer;
 	int convexity;
+	double angle;
 	Float2 origin;
 	double scale;
 	QString filename, layername;
 	DxfRotateExtrudeNode(const AbstractNode::NodeList &children, const QString &filename, const QString &layer,
 	  Float2 origin, double scale, 
-	  int convexity, const Accuracy &acc=Accuracy(), const Props p=Props())
-	    :AbstractPolyNode(p,children), Accuracy(acc), convexity(convexity),
+	  int convexity, double angle=360.0, const Accuracy &acc=Accuracy(), const Props p=Props())
+	    :AbstractPolyNode(p,children), Accuracy(acc), convexity(convexity), angle(angle),
 	    origin(origin), scale(scale), filename(filename), layername(layer) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+		return clone_as(this, children);
+	}
 };
 
 
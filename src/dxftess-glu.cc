@@ -227,17 +227,17 @@ void dxf_tesselate(PolySet *ps, DxfData *dxf, double rot, bool up, bool do_trian
 
 	Grid3d< QPair<int,int> > point_to_path(GRID_COARSE);
 
-	for (int i = 0; i < dxf->paths.count(); i++) {
-		if (!dxf->paths[i].is_closed)
+	for (int i = 0; i < (int)dxf->paths.size(); i++) {
+		const DxfData::Path &path = dxf->paths[i];
+		if (!path.is_closed)
 			continue;
 		gluTessBeginContour(tobj);
-		for (int j = 1; j < dxf->paths[i].points.count(); j++) {
-			point_to_path.data(dxf->paths[i].points[j]->x,
-					dxf->paths[i].points[j]->y,
-					h) = QPair<int,int>(i, j);
+		for (int j = 1; j < (int)path.indices.size(); j++) {
+			const DxfData::Point &p = dxf->point(path, j);
+			point_to_path.data(p.x, p.y, h) = QPair<int,int>(i, j);
 			vl.append(tess_vdata());
-			vl.last().v[0] = dxf->paths[i].points[j]->x;
-			vl.last().v[1] = dxf->paths[i].points[j]->y;
+			vl.last().v[0] = p.x;
+			vl.last().v[1] = p.y;
 			vl.last().v[2] = h;
 			gluTessVertex(tobj, vl.last().v, vl.last().v);
 		}
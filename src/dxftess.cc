@@ -25,6 +25,10 @@
  */
 
 #include "printutils.h"
+#include "node.h"
+#include "transform.h"
+#include "csgops.h"
+#include <typeinfo>
 
 #ifdef ENABLE_CGAL
 #include "dxftess-cgal.cc"
@@ -39,19 +43,154 @@
 */
 void dxf_border_to_ps(PolySet *ps, DxfData *dxf)
 {
-	for (int i = 0; i < dxf->paths.count(); i++) {
+	for (size_t i = 0; i < dxf->paths.size(); i++) {
 		const DxfData::Path &pt = dxf->paths[i];
 		if (!pt.is_closed)
 			continue;
-		ps->borders.append(PolySet::Polygon());
-		for (int j = 1; j < pt.points.count(); j++) {
-			double x = pt.points[j]->x, y = pt.points[j]->y, z = 0.0;
-			ps->grid.align(x, y, z);
+		ps->append_border();
+		for (size_t j = 1; j < pt.indices.size(); j++) {
+			const DxfData::Point &p = dxf->points[pt.indices[j]];
+			double x = p.x, y = p.y;
 			if (pt.is_inner) {
-				ps->borders.last().append(PolySet::Point(x, y, z));
+				ps->append_border_vertex(x, y, 0.0);
 			} else {
-				ps->borders.last().insert(0, PolySet::Point(x, y, z));
+				ps->insert_border_vertex(x, y, 0.0);
 			}
 		}
 	}
 }
+
+struct flatten_item_t {
+	PolySet *ps;
+	Float20 m;
+	bool is_empty;
+	double min_x, min_y, max_x, max_y;
+};
+
+static bool flatten_collect(const AbstractNode &node, const Float20 &m, QVector<flatten_item_t> &items)
+{
+	if (node.props.background)
+		return true;
+
+	if (const AbstractPolyNode *pn = dynamic_cast<const AbstractPolyNode*>(&node)) {
+		flatten_item_t item;
+		item.ps = pn->render_polyset(AbstractPolyNode::RENDER_OPENCSG);
+		if (!item.ps)
+			return false;
+		item.m = m;
+		item.is_empty = true;
+		items.append(item);
+		return item.ps->is2d;
+	}
+
+	// Implicit and explicit unions and 2D transformations can be looked
+	// through, everything else needs the exact CGAL implementation.
+	Float20 cm = m;
+	if (const TransformNode *tn = dynamic_cast<const TransformNode*>(&node)) {
+		const Float20 &t = tn->m;
+		for (int i = 0; i < 16; i++) {
+			int x = i % 4, y = i / 4;
+			cm[i] = m[x+0]*t[y*4+0] + m[x+4]*t[y*4+1] + m[x+8]*t[y*4+2] + m[x+12]*t[y*4+3];
+		}
+	} else if (const CsgNode *cn = dynamic_cast<const CsgNode*>(&node)) {
+		if (cn->type != CSG_TYPE_UNION)
+			return false;
+	} else if (typeid(node) != typeid(AbstractNode)) {
+		return false;
+	}
+
+	foreach (AbstractNode::Pointer v, node.children) {
+		if (!flatten_collect(*v, cm, items))
+			return false;
+	}
+	return true;
+}
+
+/*!
+	Collects the outlines of the 2D children of the given node into a single
+	DxfData without running any booleans. The tesselator's winding rule then
+	takes care of holes. This is only equivalent to the union of the children
+	if they don't overlap, so NULL is returned if any two bounding boxes touch
+	or if a child can't be rendered as 2D PolySet. The caller then needs to
+	fall back to the exact union.
+*/
+DxfData *dxf_flatten_children(const AbstractNode &node)
+{
+	Float20 m;
+	for (int i = 0; i < 20; i++)
+		m[i] = i % 5 == 0 ? 1.0 : 0.0;
+	m[16] = m[17] = m[18] = m[19] = -1;
+
+	QVector<flatten_item_t> items;
+	bool ok = true;
+	foreach (AbstractNode::Pointer v, node.children) {
+		if (!(ok = flatten_collect(*v, m, items)))
+			break;
+	}
+
+	DxfData *dxf = NULL;
+	if (ok)
+	{
+		dxf = new DxfData();
+		int num_paths = 0, num_points = 0;
+		for (int i = 0; i < items.size(); i++) {
+			const PolySet::PolygonList &outlines =
+					items[i].ps->borders.isEmpty() ? items[i].ps->polygons : items[i].ps->borders;
+			num_paths += outlines.size();
+			for (int j = 0; j < outlines.size(); j++)
+				num_points += outlines[j].size();
+		}
+		dxf->paths.reserve(num_paths);
+		dxf->points.reserve(num_points);
+		for (int i = 0; i < items.size(); i++)
+		{
+			flatten_item_t &item = items[i];
+			const PolySet::PolygonList &outlines =
+					item.ps->borders.isEmpty() ? item.ps->polygons : item.ps->borders;
+			int first_point = dxf->points.size();
+			for (int j = 0; j < outlines.size(); j++) {
+				if (outlines[j].size() < 3)
+					continue;
+				dxf->paths.push_back(DxfData::Path());
+				DxfData::Path &path = dxf->paths.back();
+				path.indices.reserve(outlines[j].size() + 1);
+				for (int k = 0; k < outlines[j].size(); k++) {
+					double x = outlines[j][k].x, y = outlines[j][k].y, w = item.m[15];
+					path.indices.push_back(dxf->addPoint((item.m[0]*x + item.m[4]*y + item.m[12]) / w,
+							(item.m[1]*x + item.m[5]*y + item.m[13]) / w));
+				}
+				path.indices.push_back(path.indices.front());
+				path.is_closed = true;
+			}
+			if (first_point == (int)dxf->points.size())
+				continue;
+			item.is_empty = false;
+			item.min_x = item.max_x = dxf->points[first_point].x;
+			item.min_y = item.max_y = dxf->points[first_point].y;
+			for (size_t j = first_point; j < dxf->points.size(); j++) {
+				const DxfData::Point &p = dxf->points[j];
+				item.min_x = fmin(item.min_x, p.x);
+				item.min_y = fmin(item.min_y, p.y);
+				item.max_x = fmax(item.max_x, p.x);
+				item.max_y = fmax(item.max_y, p.y);
+			}
+			for (int j = 0; j < i && ok; j++) {
+				const flatten_item_t &other = items[j];
+				if (!other.is_empty && item.min_x <= other.max_x && other.min_x <= item.max_x &&
+						item.min_y <= other.max_y && other.min_y <= item.max_y)
+					ok = false;
+			}
+			if (!ok)
+				break;
+		}
+		if (!ok) {
+			delete dxf;
+			dxf = NULL;
+		}
+	}
+
+	for (int i = 0; i < items.size(); i++)
+		items[i].ps->unlink();
+
+	return dxf;
+}
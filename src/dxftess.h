@@ -5,5 +5,6 @@ class DxfData;
 class PolySet;
 void dxf_tesselate(PolySet *ps, DxfData *dxf, double rot, bool up, bool do_triangle_splitting, double h);
 void dxf_border_to_ps(PolySet *ps, DxfData *dxf);
+DxfData *dxf_flatten_children(const class AbstractNode &node);
 
 #endif
@@ -38,7 +38,7 @@
 void cgal_nef3_to_polyset(PolySet *ps, CGAL_Nef_polyhedron *root_N)
 {
 	CGAL_Polyhedron P;
-	root_N->p3.convert_to_Polyhedron(P);
+	root_N->p3->convert_to_Polyhedron(P);
 
 	typedef CGAL_Polyhedron::Vertex                                 Vertex;
 	typedef CGAL_Polyhedron::Vertex_const_iterator                  VCI;
@@ -77,7 +77,7 @@ void cgal_nef3_to_polyset(PolySet *ps, CGAL_Nef_polyhedron *root_N)
 void export_stl(CGAL_Nef_polyhedron *root_N, QString filename, QProgressDialog *pd)
 {
 	CGAL_Polyhedron P;
-	root_N->p3.convert_to_Polyhedron(P);
+	root_N->p3->convert_to_Polyhedron(P);
 
 	typedef CGAL_Polyhedron::Vertex                                 Vertex;
 	typedef CGAL_Polyhedron::Vertex_const_iterator                  VCI;
@@ -195,9 +195,10 @@ void export_dxf(CGAL_Nef_polyhedron *root_N, QString filename, QProgressDialog *
 					"ENTITIES\n");
 
 	DxfData dd(*root_N);
-	for (int i=0; i<dd.paths.size(); i++)
+	for (size_t i=0; i<dd.paths.size(); i++)
 	{
-		if (dd.paths[i].points.size() < 2)
+		const DxfData::Path &path = dd.paths[i];
+		if (path.indices.size() < 2)
 			// not a valid polygon
 			continue;
 		// Use the LWPOLYLINE class - this makes it easier to handle complete
@@ -209,17 +210,17 @@ void export_dxf(CGAL_Nef_polyhedron *root_N, QString filename, QProgressDialog *
 		fprintf(f, "0\n");
 		// number of vertices
 		fprintf(f, "  90\n");
-		fprintf(f, "%d\n", dd.paths[i].points.size());
+		fprintf(f, "%d\n", (int)path.indices.size());
 		// polygon flag (closed, ...)
 		fprintf(f, "  70\n");
-		fprintf(f, "%d\n", dd.paths[i].is_closed ? 1 : 0);
+		fprintf(f, "%d\n", path.is_closed ? 1 : 0);
 		// add all points
-		for (int j=0; j<dd.paths[i].points.size(); j++) {
-			DxfData::Point *p = dd.paths[i].points[j];
+		for (size_t j=0; j<path.indices.size(); j++) {
+			const DxfData::Point &p = dd.points[path.indices[j]];
 			fprintf(f, " 10\n");
-			fprintf(f, "%f\n", p->x);
+			fprintf(f, "%f\n", p.x);
 			fprintf(f, " 20\n");
-			fprintf(f, "%f\n", p->y);
+			fprintf(f, "%f\n", p.y);
 		}
 	}
 
@@ -0,0 +1,152 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "gmppool.h"
+
+#ifdef ENABLE_CGAL
+
+#include "printutils.h"
+#include <gmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+bool GmpPool::enabled = false;
+
+static const size_t granule = sizeof(mp_limb_t);
+static const int num_classes = 64;             // blocks of up to 64 limbs
+static const size_t max_cached = 64 << 20;     // bytes kept in the free lists
+
+struct free_block_t {
+	free_block_t *next;
+};
+
+static free_block_t *free_lists[num_classes + 1];
+static size_t cached;
+static unsigned long recycled, allocated;
+
+/*!
+	Returns the free list for blocks of the given size, 0 if they aren't pooled
+*/
+static int size_class(size_t size)
+{
+	if (size < sizeof(free_block_t) || size % granule != 0 || size > num_classes * granule)
+		return 0;
+	return size / granule;
+}
+
+static void *checked_malloc(size_t size)
+{
+	void *p = malloc(size);
+	if (!p) {
+		fprintf(stderr, "GNU MP: Cannot allocate memory (size=%lu)\n", (unsigned long)size);
+		abort();
+	}
+	return p;
+}
+
+static void *pool_alloc(size_t size)
+{
+	allocated++;
+	int c = size_class(size);
+	if (c && free_lists[c]) {
+		free_block_t *b = free_lists[c];
+		free_lists[c] = b->next;
+		cached -= size;
+		recycled++;
+		return b;
+	}
+	return checked_malloc(size);
+}
+
+static void pool_free(void *p, size_t size)
+{
+	int c = size_class(size);
+	if (!c || cached + size > max_cached) {
+		free(p);
+		return;
+	}
+	free_block_t *b = (free_block_t*)p;
+	b->next = free_lists[c];
+	free_lists[c] = b;
+	cached += size;
+}
+
+static void *pool_realloc(void *p, size_t old_size, size_t new_size)
+{
+	int c = size_class(old_size);
+	if (!c) {
+		// Not from a free list, or GMP didn't tell the old size
+		void *q = realloc(p, new_size);
+		if (!q) {
+			fprintf(stderr, "GNU MP: Cannot reallocate memory (new_size=%lu)\n", (unsigned long)new_size);
+			abort();
+		}
+		return q;
+	}
+	if (old_size == new_size)
+		return p;
+	void *q = pool_alloc(new_size);
+	memcpy(q, p, old_size < new_size ? old_size : new_size);
+	pool_free(p, old_size);
+	return q;
+}
+
+/*!
+	Makes GMP allocate through the pool. Must only be called once.
+*/
+void GmpPool::install()
+{
+	mp_set_memory_functions(pool_alloc, pool_realloc, pool_free);
+}
+
+/*!
+	Returns the blocks in the free lists to malloc. Called after each top
+	level render, so the memory of one render's temporaries isn't held
+	while the program sits idle or renders something else.
+*/
+void GmpPool::trim()
+{
+	for (int c = 1; c <= num_classes; c++) {
+		while (free_lists[c]) {
+			free_block_t *b = free_lists[c];
+			free_lists[c] = b->next;
+			free(b);
+		}
+	}
+	cached = 0;
+	recycled = allocated = 0;
+}
+
+void GmpPool::print_report()
+{
+	if (!enabled || allocated == 0)
+		return;
+	PRINTF("GMP pool: %lu of %lu allocations recycled (%.1f%%), %lu KiB cached.",
+			recycled, allocated, 100.0 * recycled / allocated, (unsigned long)(cached >> 10));
+}
+
+#endif // ENABLE_CGAL
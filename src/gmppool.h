@@ -0,0 +1,57 @@
+#ifndef GMPPOOL_H_
+#define GMPPOOL_H_
+
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef ENABLE_CGAL
+
+/*!
+	Recycles the limb arrays GMP allocates for the exact numbers of CGAL.
+	Every predicate on Gmpq coordinates creates and destroys temporaries,
+	so most of these blocks are freed right after they were allocated and
+	are soon needed again in the same size. Freed blocks are kept in one
+	free list per size, in multiples of the limb size, and handed out
+	again instead of going through malloc. Odd or large sizes are passed
+	through to malloc.
+
+	Every block is a plain malloc block, so blocks GMP allocated before
+	the pool was installed can be freed to it as well. The pool isn't
+	thread safe; all exact arithmetic runs on the main thread.
+*/
+class GmpPool
+{
+public:
+	static bool enabled;
+
+	static void install();
+	static void trim();
+	static void print_report();
+};
+
+#endif
+
+#endif
@@ -4,21 +4,121 @@
 #include "mathc99.h"
 #ifdef WIN32
 typedef __int64 int64_t;
+typedef unsigned __int64 uint64_t;
 #else
 #include <stdint.h>
 #endif
 #include <stdlib.h>
+#include <vector>
+#include <deque>
 #include <QHash>
 
 const double GRID_COARSE = 0.001;
 const double GRID_FINE   = 0.000001;
 
+/*!
+	Open addressing hash table from D-dimensional integer grid cells to
+	values of type T, with linear probing over a power of two sized array.
+	The values live in a deque, so references to them stay valid while the
+	table grows, just like the node based QHash this replaces.
+*/
+template <int D, typename T>
+class GridTable
+{
+public:
+	GridTable() : count(0) {
+		resize(16);
+	}
+
+	int size() const {
+		return count;
+	}
+
+	/*!
+		Returns the value stored for key or NULL if there is none.
+	*/
+	T *find(const int64_t *key) const {
+		const Cell &c = cells[probe(key)];
+		if (c.value < 0)
+			return NULL;
+		return const_cast<T*>(&values[c.value]);
+	}
+
+	/*!
+		Returns the value stored for key, adding a default constructed one
+		if there is none.
+	*/
+	T &insert(const int64_t *key) {
+		size_t i = probe(key);
+		if (cells[i].value >= 0)
+			return values[cells[i].value];
+		if (2 * (count + 1) > (int)cells.size()) {
+			resize(2 * cells.size());
+			i = probe(key);
+		}
+		for (int d = 0; d < D; d++)
+			cells[i].key[d] = key[d];
+		cells[i].value = count++;
+		values.push_back(T());
+		return values.back();
+	}
+
+private:
+	struct Cell {
+		int64_t key[D];
+		int value;  // index into values, -1 if the cell is empty
+	};
+	std::vector<Cell> cells;
+	std::deque<T> values;
+	int count;
+
+	static size_t hash(const int64_t *key) {
+		static const uint64_t mul[3] = {
+			0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL
+		};
+		uint64_t h = 0;
+		for (int d = 0; d < D; d++)
+			h ^= (uint64_t)key[d] * mul[d];
+		h ^= h >> 29;
+		return (size_t)h;
+	}
+
+	/*!
+		Returns the cell holding key, or the empty cell where it belongs.
+	*/
+	size_t probe(const int64_t *key) const {
+		size_t mask = cells.size() - 1;
+		for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+			const Cell &c = cells[i];
+			if (c.value < 0)
+				return i;
+			bool same = true;
+			for (int d = 0; d < D; d++)
+				same = same && c.key[d] == key[d];
+			if (same)
+				return i;
+		}
+	}
+
+	void resize(size_t n) {
+		std::vector<Cell> old;
+		old.swap(cells);
+		Cell empty;
+		empty.value = -1;
+		cells.assign(n, empty);
+		for (size_t i = 0; i < old.size(); i++) {
+			if (old[i].value >= 0)
+				cells[probe(old[i].key)] = old[i];
+		}
+	}
+};
+
 template <typename T>
 class Grid2d
 {
 public:
 	double res;
-	QHash<QPair<int64_t,int64_t>, T> db;
+	GridTable<2, T> db;
 
 	Grid2d(double resolution) {
 		res = resolution;
@@ -27,39 +127,18 @@ public:
 		Aligns x,y to the grid or to existing point if one close enough exists.
 		Returns the value stored if a point already existing or an uninitialized new value
 		if not.
-	*/ 
+	*/
 	T &align(double &x, double &y) {
-		int64_t ix = (int64_t)round(x / res);
-		int64_t iy = (int64_t)round(y / res);
-		if (!db.contains(QPair<int64_t,int64_t>(ix, iy))) {
-			int dist = 10;
-			for (int64_t jx = ix - 1; jx <= ix + 1; jx++) {
-				for (int64_t jy = iy - 1; jy <= iy + 1; jy++) {
-					if (!db.contains(QPair<int64_t,int64_t>(jx, jy)))
-						continue;
-					int d = abs(int(ix-jx)) + abs(int(iy-jy));
-					if (d < dist) {
-					  dist = d;
-						ix = jx;
-						iy = jy;
-					}
-				}
-			}
-		}
-		x = ix * res, y = iy * res;
-		return db[QPair<int64_t,int64_t>(ix, iy)];
+		int64_t key[2] = { (int64_t)round(x / res), (int64_t)round(y / res) };
+		T *v = db.find(key);
+		if (!v)
+			v = nearest(key);
+		x = key[0] * res, y = key[1] * res;
+		return v ? *v : db.insert(key);
 	}
 	bool has(double x, double y) const {
-		int64_t ix = (int64_t)round(x / res);
-		int64_t iy = (int64_t)round(y / res);
-		if (db.contains(QPair<int64_t,int64_t>(ix, iy)))
-			return true;
-		for (int64_t jx = ix - 1; jx <= ix + 1; jx++)
-		for (int64_t jy = iy - 1; jy <= iy + 1; jy++) {
-			if (db.contains(QPair<int64_t,int64_t>(jx, jy)))
-				return true;
-		}
-		return false;
+		int64_t key[2] = { (int64_t)round(x / res), (int64_t)round(y / res) };
+		return db.find(key) || nearest(key);
 	}
 	bool eq(double x1, double y1, double x2, double y2) {
 		align(x1, y1);
@@ -74,6 +153,37 @@ public:
 	T &operator()(double x, double y) {
 		return align(x, y);
 	}
+
+private:
+	/*!
+		Scans the neighbours of an empty cell in a single pass, moving key
+		onto every existing one that is closer to it than the last, just
+		like the QHash based version did. Once key sits on a neighbour at
+		distance one nothing can replace it, so the scan stops there.
+	*/
+	T *nearest(int64_t *key) const {
+		if (db.size() == 0)
+			return NULL;
+		T *best = NULL;
+		int dist = 10;
+		for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++)
+		for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++) {
+			int64_t j[2] = { jx, jy };
+			T *v = db.find(j);
+			if (!v)
+				continue;
+			int d = abs(int(key[0]-jx)) + abs(int(key[1]-jy));
+			if (d < dist) {
+				dist = d;
+				key[0] = jx;
+				key[1] = jy;
+				best = v;
+				if (d == 1)
+					return best;
+			}
+		}
+		return best;
+	}
 };
 
 template <typename T>
@@ -81,50 +191,22 @@ class Grid3d
 {
 public:
 	double res;
-	QHash<QPair<QPair<int64_t,int64_t>,int64_t>, T> db;
+	GridTable<3, T> db;
 
 	Grid3d(double resolution) {
 		res = resolution;
 	}
 	T &align(double &x, double &y, double &z) {
-		int64_t ix = (int64_t)round(x / res);
-		int64_t iy = (int64_t)round(y / res);
-		int64_t iz = (int64_t)round(z / res);
-		if (!db.contains(QPair<QPair<int64_t,int64_t>,int64_t>(QPair<int64_t,int64_t>(ix, iy), iz))) {
-			int dist = 10;
-			for (int64_t jx = ix - 1; jx <= ix + 1; jx++) {
-				for (int64_t jy = iy - 1; jy <= iy + 1; jy++) {
-					for (int64_t jz = iz - 1; jz <= iz + 1; jz++) {
-						if (!db.contains(QPair<QPair<int64_t,int64_t>,int64_t>(QPair<int64_t,int64_t>(jx, jy), jz)))
-							continue;
-						int d = abs(int(ix-jx)) + abs(int(iy-jy)) + abs(int(iz-jz));
-						if (d < dist) {
-						  dist = d;
-							ix = jx;
-							iy = jy;
-							iz = jz;
-						}
-					}
-				}
-			}
-		}
-		x = ix * res, y = iy * res, z = iz * res;
-		return db[QPair<QPair<int64_t,int64_t>,int64_t>(QPair<int64_t,int64_t>(ix, iy), iz)];
-	}
-	bool has(double x, double y, double z) {
-		int64_t ix = (int64_t)round(x / res);
-		int64_t iy = (int64_t)round(y / res);
-		int64_t iz = (int64_t)round(z / res);
-		if (db.contains(QPair<QPair<int64_t,int64_t>,int64_t>(QPair<int64_t,int64_t>(ix, iy), iz)))
-			return true;
-		for (int64_t jx = ix - 1; jx <= ix + 1; jx++)
-		for (int64_t jy = iy - 1; jy <= iy + 1; jy++)
-		for (int64_t jz = iz - 1; jz <= iz + 1; jz++) {
-			if (db.contains(QPair<QPair<int64_t,int64_t>,int64_t>(QPair<int64_t,int64_t>(jx, jy), jz)))
-				return true;
-		}
-		return false;
-		
+		int64_t key[3] = { (int64_t)round(x / res), (int64_t)round(y / res), (int64_t)round(z / res) };
+		T *v = db.find(key);
+		if (!v)
+			v = nearest(key);
+		x = key[0] * res, y = key[1] * res, z = key[2] * res;
+		return v ? *v : db.insert(key);
+	}
+	bool has(double x, double y, double z) const {
+		int64_t key[3] = { (int64_t)round(x / res), (int64_t)round(y / res), (int64_t)round(z / res) };
+		return db.find(key) || nearest(key);
 	}
 	bool eq(double x1, double y1, double z1, double x2, double y2, double z2) {
 		align(x1, y1, z1);
@@ -139,6 +221,33 @@ public:
 	T &operator()(double x, double y, double z) {
 		return align(x, y, z);
 	}
+
+private:
+	T *nearest(int64_t *key) const {
+		if (db.size() == 0)
+			return NULL;
+		T *best = NULL;
+		int dist = 10;
+		for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++)
+		for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++)
+		for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
+			int64_t j[3] = { jx, jy, jz };
+			T *v = db.find(j);
+			if (!v)
+				continue;
+			int d = abs(int(key[0]-jx)) + abs(int(key[1]-jy)) + abs(int(key[2]-jz));
+			if (d < dist) {
+				dist = d;
+				key[0] = jx;
+				key[1] = jy;
+				key[2] = jz;
+				best = v;
+				if (d == 1)
+					return best;
+			}
+		}
+		return best;
+	}
 };
 
 #endif
@@ -137,45 +137,36 @@ PolySet *ImportOFFNode::render_polyset(render_mode_e) const {
   return p;
 }
 
-QString ImportSTLNode::dump(QString indent) const {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    struct stat st;
-    memset(&st, 0, sizeof(struct stat));
-    stat(filename.toAscii().data(), &st);
-    text.sprintf("import_stl(file = \"%s\", cache = \"%x.%x\", convexity = %d);\n",
-		    filename.toAscii().data(), (int)st.st_mtime, (int)st.st_size, convexity);
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;  
+void ImportSTLNode::dump_statement(QTextStream &out) const {
+  QString text;
+  struct stat st;
+  memset(&st, 0, sizeof(struct stat));
+  stat(filename.toAscii().data(), &st);
+  text.sprintf("import_stl(file = \"%s\", cache = \"%x.%x\", convexity = %d)",
+	  filename.toAscii().data(), (int)st.st_mtime, (int)st.st_size, convexity);
+  out << text;
 }
 
-QString ImportOFFNode::dump(QString indent) const {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    struct stat st;
-    memset(&st, 0, sizeof(struct stat));
-    stat(filename.toAscii().data(), &st);
-    text.sprintf("import_off(file = \"%s\", cache = \"%x.%x\", convexity = %d);\n",
-		    filename.toAscii().data(), (int)st.st_mtime, (int)st.st_size, convexity);
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+void ImportOFFNode::dump_statement(QTextStream &out) const {
+  QString text;
+  struct stat st;
+  memset(&st, 0, sizeof(struct stat));
+  stat(filename.toAscii().data(), &st);
+  text.sprintf("import_off(file = \"%s\", cache = \"%x.%x\", convexity = %d)",
+	  filename.toAscii().data(), (int)st.st_mtime, (int)st.st_size, convexity);
+  out << text;
 }
 
-QString ImportDXFNode::dump(QString indent) const {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    struct stat st;
-    memset(&st, 0, sizeof(struct stat));
-    stat(filename.toAscii().data(), &st);
-    text.sprintf("import_dxf(file = \"%s\", cache = \"%x.%x\", layer = \"%s\", "
-		    "origin = [ %g %g ], scale = %g, convexity = %d, "
-		    "$fn = %g, $fa = %g, $fs = %g);\n",
-		    filename.toAscii().data(), (int)st.st_mtime, (int)st.st_size,
-		    layername.toAscii().data(), origin[0], origin[1], scale, convexity,
-		    fn, fa, fs);
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+void ImportDXFNode::dump_statement(QTextStream &out) const {
+  QString text;
+  struct stat st;
+  memset(&st, 0, sizeof(struct stat));
+  stat(filename.toAscii().data(), &st);
+  text.sprintf("import_dxf(file = \"%s\", cache = \"%x.%x\", layer = \"%s\", "
+	  "origin = [ %g %g ], scale = %g, convexity = %d, "
+	  "$fn = %g, $fa = %g, $fs = %g)",
+	  filename.toAscii().data(), (int)st.st_mtime, (int)st.st_size,
+	  layername.toAscii().data(), origin[0], origin[1], scale, convexity,
+	  fn, fa, fs);
+  out << text;
 }
\ No newline at end of file
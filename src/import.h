@@ -45,7 +45,7 @@ class ImportSTLNode : public ImportNode {
 public:	
   ImportSTLNode(const QString &filename, int convexity, const Props p=Props()):ImportNode(filename, convexity, p) {}
   virtual PolySet *render_polyset(render_mode_e mode) const;
-  virtual QString dump(QString indent) const;
+  virtual void dump_statement(QTextStream &out) const;
 };
 
 class ImportDXFNode : public ImportNode, public Accuracy {
@@ -57,14 +57,14 @@ public:
   ImportDXFNode(const QString &filename,const QString &layername, Float2 origin, int convexity=5, double scale=1.0, const Accuracy &acc=Accuracy(), const Props p=Props())
     :ImportNode(filename, convexity, p), Accuracy(acc), layername(layername), origin(origin), scale(scale) {}
   virtual PolySet *render_polyset(render_mode_e mode) const;
-  virtual QString dump(QString indent) const;
+  virtual void dump_statement(QTextStream &out) const;
 };
 
 class ImportOFFNode : public ImportNode {
 public:	
   ImportOFFNode(const QString &filename, int convexity, const Props p=Props()):ImportNode(filename, convexity, p) {}
   virtual PolySet *render_polyset(render_mode_e mode) const;
-  virtual QString dump(QString indent) const;
+  virtual void dump_statement(QTextStream &out) const;
 };
 
 #endif
\ No newline at end of file
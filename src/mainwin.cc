@@ -39,6 +39,9 @@
 #include "dxftess.h"
 #include "progress.h"
 #include "pythonscripting.h"
+#include "optimizer.h"
+#include "planner.h"
+#include "gmppool.h"
 #ifdef ENABLE_OPENCSG
 #include "render-opencsg.h"
 #endif
@@ -69,6 +72,7 @@
 #include <QMessageBox>
 #include <QDesktopServices>
 #include <QSettings>
+#include <QSet>
 #ifdef _QCODE_EDIT_
 #include "qdocument.h"
 #include "qformatscheme.h"
@@ -506,18 +510,37 @@ AbstractNode::Pointer MainWindow::find_root_tag(AbstractNode::Pointer n)
 	return AbstractNode::Pointer();
 }
 
+static void csg_props_key(const AbstractNode *node, QSet<const AbstractNode*> &visited, QCryptographicHash &hash)
+{
+	if (visited.contains(node))
+		return;
+	visited.insert(node);
+	QString key = QString("|n%1:%2%3:").arg(node->idx).arg(node->props.highlight).arg(node->props.background);
+	foreach (AbstractNode::Pointer v, node->children)
+		key += QString::number(v->idx) + ",";
+	hash.addData(key.toAscii());
+	foreach (AbstractNode::Pointer v, node->children)
+		csg_props_key(v.get(), visited, hash);
+}
+
 /*!
-	Parse and evaluate the design -> this->root_node
+	Identifies the CSG products of a tree: the id of its content plus the
+	node labels and modifiers, as they end up in the products.
 */
-void MainWindow::compile(bool procevents)
+static QString csg_tree_key(const AbstractNode *root)
 {
-	PRINT("Parsing design (AST generation)...");
-	if (procevents)
-		QApplication::processEvents();
-
+	QSet<const AbstractNode*> visited;
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(root->mk_cache_id().toAscii());
+	csg_props_key(root, visited, hash);
+	return hash.result().toHex();
+}
 
-	// Remove previous CSG tree
-	absolute_root_node.reset();
+/*!
+	Releases the CSG products of the previous compile
+*/
+void MainWindow::clearCSG()
+{
 	if (root_raw_term) {
 		root_raw_term->unlink();
 		root_raw_term = NULL;
@@ -549,11 +572,26 @@ void MainWindow::compile(bool procevents)
 		delete background_chain;
 		background_chain = NULL;
 	}
-	root_node.reset();
 	enableOpenCSG = false;
+}
+
+/*!
+	Parse and evaluate the design -> this->root_node
+*/
+void MainWindow::compile(bool procevents)
+{
+	PRINT("Parsing design (AST generation)...");
+	if (procevents)
+		QApplication::processEvents();
+
+
+	// Remove previous tree; the CSG products stay until we know whether it changed
+	absolute_root_node.reset();
+	root_node.reset();
 
 	// Parse
 	last_compiled_doc = editor->toPlainText();
+	AbstractNode::resetIndexCounter();
 	PythonScript pyvm(e_tval->text().toDouble());
 	root_node = absolute_root_node = pyvm.evaluate((last_compiled_doc + "\n" + commandline_commands).toStdString(), this->fileName.isEmpty() ? "" : QFileInfo(this->fileName).absolutePath().toStdString());
 	if (!absolute_root_node) {
@@ -567,7 +605,20 @@ void MainWindow::compile(bool procevents)
 	if (!(this->root_node = find_root_tag(absolute_root_node))) {
 		this->root_node = absolute_root_node;
 	}
-	root_node->dump("");
+	if (TreeOptimizer::enabled) {
+		TreeOptimizer optimizer;
+		root_node = optimizer.optimize(root_node);
+		optimizer.print_report();
+	}
+
+	// Keep the CSG products if they were compiled from the same tree
+	{
+		QString key = csg_tree_key(root_node.get());
+		if (key != csg_key) {
+			clearCSG();
+			csg_key = key;
+		}
+	}
 
 	if (1) {
 		PRINT("Compilation finished.");
@@ -575,6 +626,8 @@ void MainWindow::compile(bool procevents)
 			QApplication::processEvents();
 	} else {
 fail:
+		clearCSG();
+		csg_key = QString();
 /*		if (parser_error_pos < 0) {
 		  PRINT("ERROR: Compilation failed! (no top level object found)");
 		} else {
@@ -596,6 +649,9 @@ fail:
 	}
 }
 
+// Normalization gives up on trees whose rendering chain grows past this
+static const int NORMALIZE_MAX_ELEMENTS = 100000;
+
 /*!
 	Generates CSG tree for OpenCSG evaluation.
 	Assumes that the design has been parsed and evaluated
@@ -603,6 +659,11 @@ fail:
 void MainWindow::compileCSG(bool procevents)
 {
 	assert(this->root_node);
+	if (root_raw_term) {
+		PRINT("Design unchanged, reusing the previous CSG products.");
+		return;
+	}
+	clearCSG();
 	PRINT("Compiling design (CSG Products generation)...");
 	if (procevents)
 		QApplication::processEvents();
@@ -633,6 +694,7 @@ void MainWindow::compileCSG(bool procevents)
 	QApplication::processEvents();
 
 	progress_report_prep(*root_node, report_func, pd);
+	AbstractPolyNode::begin_csg_generation();
 	try {
 		root_raw_term = root_node->render_csg_term(m, &highlight_terms, &background_terms);
 		if (!root_raw_term) {
@@ -644,6 +706,7 @@ void MainWindow::compileCSG(bool procevents)
 	catch (ProgressCancelException e) {
 		PRINT("CSG generation cancelled.");
 	}
+	AbstractPolyNode::end_csg_generation();
 	progress_report_fin();
 #ifdef USE_PROGRESSWIDGET
 	this->statusBar()->removeWidget(pd);
@@ -655,27 +718,29 @@ void MainWindow::compileCSG(bool procevents)
 		if (procevents)
 			QApplication::processEvents();
 		
-		root_norm_term = root_raw_term->link();
-		
-		// CSG normalization
-		while (1) {
-			CSGTerm *n = root_norm_term->normalize();
-			root_norm_term->unlink();
-			if (root_norm_term == n)
-				break;
-			root_norm_term = n;
-		}
-		
-		assert(root_norm_term);
-
-		root_chain = new CSGChain();
-		root_chain->import(root_norm_term);
-		
-		if (root_chain->polysets.size() > 1000) {
-			PRINTF("WARNING: Normalized tree has %d elements!", root_chain->polysets.size());
+		// CSG normalization. Trees whose products explode are given up on
+		// early and shown as they are. Products that bounding boxes show to
+		// be empty are dropped, which may leave nothing to render at all.
+		CSGNormalizer normalizer(NORMALIZE_MAX_ELEMENTS);
+		root_norm_term = normalizer.normalize(root_raw_term);
+		if (normalizer.exceeded) {
+			PRINTF("WARNING: Normalized tree has more than %d elements!", NORMALIZE_MAX_ELEMENTS);
 			PRINTF("WARNING: OpenCSG rendering has been disabled.");
+			root_norm_term = root_raw_term->link();
+			root_chain = new CSGChain();
+			root_chain->import(root_norm_term);
 		} else {
-			enableOpenCSG = true;
+			root_chain = new CSGChain();
+			if (root_norm_term)
+				root_chain->import(root_norm_term);
+			else
+				PRINT("WARNING: Normalized tree is empty.");
+			if (root_chain->size() > 1000) {
+				PRINTF("WARNING: Normalized tree has %d elements!", root_chain->size());
+				PRINTF("WARNING: OpenCSG rendering has been disabled.");
+			} else {
+				enableOpenCSG = true;
+			}
 		}
 		
 		if (highlight_terms.size() > 0)
@@ -686,14 +751,13 @@ void MainWindow::compileCSG(bool procevents)
 			
 			highlights_chain = new CSGChain();
 			for (int i = 0; i < highlight_terms.size(); i++) {
-				while (1) {
-					CSGTerm *n = highlight_terms[i]->normalize();
+				CSGTerm *n = normalizer.normalize(highlight_terms[i]);
+				if (n) {
 					highlight_terms[i]->unlink();
-					if (highlight_terms[i] == n)
-						break;
 					highlight_terms[i] = n;
 				}
-				highlights_chain->import(highlight_terms[i]);
+				if (n || normalizer.exceeded)
+					highlights_chain->import(highlight_terms[i]);
 			}
 		}
 		
@@ -705,14 +769,13 @@ void MainWindow::compileCSG(bool procevents)
 			
 			background_chain = new CSGChain();
 			for (int i = 0; i < background_terms.size(); i++) {
-				while (1) {
-					CSGTerm *n = background_terms[i]->normalize();
+				CSGTerm *n = normalizer.normalize(background_terms[i]);
+				if (n) {
 					background_terms[i]->unlink();
-					if (background_terms[i] == n)
-						break;
 					background_terms[i] = n;
 				}
-				background_chain->import(background_terms[i]);
+				if (n || normalizer.exceeded)
+					background_chain->import(background_terms[i]);
 			}
 		}
 		
@@ -1018,6 +1081,15 @@ void MainWindow::actionRenderCGAL()
 	PRINT("Rendering Polygon Mesh using CGAL...");
 	QApplication::processEvents();
 
+	RenderPlanner planner;
+	if (RenderPlanner::enabled) {
+		planner.plan(root_node.get());
+		planner.print_report();
+		if (RenderPlanner::explain)
+			planner.print_plan(root_node.get());
+		QApplication::processEvents();
+	}
+
 	QTime t;
 	t.start();
 
@@ -1045,51 +1117,61 @@ void MainWindow::actionRenderCGAL()
 		PRINT("Rendering cancelled.");
 	}
 	progress_report_fin();
+	GmpPool::print_report();
+	GmpPool::trim();
 
 	if (this->root_N)
 	{
+		if (RenderPlanner::enabled)
+			planner.calibrate(t.elapsed());
 		PRINTF("Number of vertices currently in CGAL cache: %d", AbstractNode::cgal_nef_cache.totalCost());
 		PRINTF("Number of objects currently in CGAL cache: %d", AbstractNode::cgal_nef_cache.size());
 		QApplication::processEvents();
 
+		if (AbstractNode::cgal_nef_telemetry) {
+			PRINT("   Per node results:");
+			root_node->print_cgal_telemetry("   ");
+			QApplication::processEvents();
+		}
+
 		if (this->root_N->dim == 2) {
 			PRINTF("   Top level object is a 2D object:");
 			QApplication::processEvents();
-			PRINTF("   Empty:      %6s", this->root_N->p2.is_empty() ? "yes" : "no");
+			PRINTF("   Empty:      %6s", this->root_N->p2->is_empty() ? "yes" : "no");
 			QApplication::processEvents();
-			PRINTF("   Plane:      %6s", this->root_N->p2.is_plane() ? "yes" : "no");
+			PRINTF("   Plane:      %6s", this->root_N->p2->is_plane() ? "yes" : "no");
 			QApplication::processEvents();
-			PRINTF("   Vertices:   %6d", (int)this->root_N->p2.explorer().number_of_vertices());
+			PRINTF("   Vertices:   %6d", (int)this->root_N->p2->explorer().number_of_vertices());
 			QApplication::processEvents();
-			PRINTF("   Halfedges:  %6d", (int)this->root_N->p2.explorer().number_of_halfedges());
+			PRINTF("   Halfedges:  %6d", (int)this->root_N->p2->explorer().number_of_halfedges());
 			QApplication::processEvents();
-			PRINTF("   Edges:      %6d", (int)this->root_N->p2.explorer().number_of_edges());
+			PRINTF("   Edges:      %6d", (int)this->root_N->p2->explorer().number_of_edges());
 			QApplication::processEvents();
-			PRINTF("   Faces:      %6d", (int)this->root_N->p2.explorer().number_of_faces());
+			PRINTF("   Faces:      %6d", (int)this->root_N->p2->explorer().number_of_faces());
 			QApplication::processEvents();
-			PRINTF("   FaceCycles: %6d", (int)this->root_N->p2.explorer().number_of_face_cycles());
+			PRINTF("   FaceCycles: %6d", (int)this->root_N->p2->explorer().number_of_face_cycles());
 			QApplication::processEvents();
-			PRINTF("   ConnComp:   %6d", (int)this->root_N->p2.explorer().number_of_connected_components());
+			PRINTF("   ConnComp:   %6d", (int)this->root_N->p2->explorer().number_of_connected_components());
 			QApplication::processEvents();
 		}
 
 		if (this->root_N->dim == 3) {
 			PRINTF("   Top level object is a 3D object:");
-			PRINTF("   Simple:     %6s", this->root_N->p3.is_simple() ? "yes" : "no");
+			PRINTF("   Simple:     %6s", this->root_N->p3->is_simple() ? "yes" : "no");
 			QApplication::processEvents();
-			PRINTF("   Valid:      %6s", this->root_N->p3.is_valid() ? "yes" : "no");
+			PRINTF("   Valid:      %6s", CGAL_Nef_polyhedron3(*this->root_N->p3).is_valid() ? "yes" : "no");
 			QApplication::processEvents();
-			PRINTF("   Vertices:   %6d", (int)this->root_N->p3.number_of_vertices());
+			PRINTF("   Vertices:   %6d", (int)this->root_N->p3->number_of_vertices());
 			QApplication::processEvents();
-			PRINTF("   Halfedges:  %6d", (int)this->root_N->p3.number_of_halfedges());
+			PRINTF("   Halfedges:  %6d", (int)this->root_N->p3->number_of_halfedges());
 			QApplication::processEvents();
-			PRINTF("   Edges:      %6d", (int)this->root_N->p3.number_of_edges());
+			PRINTF("   Edges:      %6d", (int)this->root_N->p3->number_of_edges());
 			QApplication::processEvents();
-			PRINTF("   Halffacets: %6d", (int)this->root_N->p3.number_of_halffacets());
+			PRINTF("   Halffacets: %6d", (int)this->root_N->p3->number_of_halffacets());
 			QApplication::processEvents();
-			PRINTF("   Facets:     %6d", (int)this->root_N->p3.number_of_facets());
+			PRINTF("   Facets:     %6d", (int)this->root_N->p3->number_of_facets());
 			QApplication::processEvents();
-			PRINTF("   Volumes:    %6d", (int)this->root_N->p3.number_of_volumes());
+			PRINTF("   Volumes:    %6d", (int)this->root_N->p3->number_of_volumes());
 			QApplication::processEvents();
 		}
 
@@ -1137,7 +1219,11 @@ void MainWindow::actionDisplayCSGTree()
 	e->setWindowTitle("CSG Tree Dump");
 	e->setReadOnly(true);
 	if (root_node) {
-		e->setPlainText(root_node->dump(""));
+		QString text;
+		QTextStream out(&text);
+		root_node->dump(out, "");
+		out.flush();
+		e->setPlainText(text);
 	} else {
 		e->setPlainText("No CSG to dump. Please try compiling first...");
 	}
@@ -1181,7 +1267,7 @@ void MainWindow::actionExportSTLorOFF(bool)
 		return;
 	}
 
-	if (!this->root_N->p3.is_simple()) {
+	if (!this->root_N->p3->is_simple()) {
 		PRINT("Object isn't a valid 2-manifold! Modify your design..");
 		clearCurrentOutput();
 		return;
@@ -1198,7 +1284,7 @@ void MainWindow::actionExportSTLorOFF(bool)
 
 	QProgressDialog *pd = new QProgressDialog(
 			stl_mode ? "Exporting object to STL file..." : "Exporting object to OFF file...",
-			QString(), 0, this->root_N->p3.number_of_facets() + 1);
+			QString(), 0, this->root_N->p3->number_of_facets() + 1);
 	pd->setValue(0);
 	pd->setAutoClose(false);
 	pd->show();
@@ -1267,6 +1353,10 @@ void MainWindow::actionFlushCaches()
 #endif
 	dxf_dim_cache.clear();
 	dxf_cross_cache.clear();
+	// Imported files may have changed, which the cache ids don't show
+	clearCSG();
+	csg_key = QString();
+	AbstractPolyNode::flush_csg_polysets();
 }
 
 void MainWindow::viewModeActionsUncheck()
@@ -1372,7 +1462,7 @@ static void renderGLviaCGAL(void *vp)
 		typedef Explorer::Face_const_iterator fci_t;
 		typedef Explorer::Halfedge_around_face_const_circulator heafcc_t;
 		typedef Explorer::Point Point;
-		Explorer E = m->root_N->p2.explorer();
+		Explorer E = m->root_N->p2->explorer();
 		
 		// Draw 2D edges
 		glDisable(GL_DEPTH_TEST);
@@ -1420,7 +1510,7 @@ static void renderGLviaCGAL(void *vp)
 																										 Preferences::inst()->color(Preferences::CGAL_FACE_FRONT_COLOR).green(),
 																										 Preferences::inst()->color(Preferences::CGAL_FACE_FRONT_COLOR).blue());
 			m->cgal_ogl_p = p = new Polyhedron();
-			Nef3_Converter<CGAL_Nef_polyhedron3>::convert_to_OGLPolyhedron(m->root_N->p3, p);
+			Nef3_Converter<CGAL_Nef_polyhedron3>::convert_to_OGLPolyhedron(*m->root_N->p3, p);
 			p->init();
 		}
 		if (m->viewActionCGALSurfaces->isChecked())
@@ -1467,59 +1557,60 @@ void MainWindow::viewModeCGALGrid()
 static void renderGLThrownTogetherChain(MainWindow *m, CSGChain *chain, bool highlight, bool background, bool fberror)
 {
 	glDepthFunc(GL_LEQUAL);
-	typedef std::pair< PolySet*, Float20Ptr > PolySetInst;
+	typedef std::pair< PolySet*, boost::array<float, 16> > PolySetInst;
 	std::map<PolySetInst,int> polySetVisitMark;
 	bool showEdges = m->viewActionShowEdges->isChecked();
-	for (int i = 0; i < chain->polysets.size(); i++) {
-		if (polySetVisitMark[PolySetInst(chain->polysets[i], chain->matrices[i])]++ > 0)
+	for (int i = 0; i < chain->size(); i++) {
+		const CSGChain::Element &e = chain->elements[i];
+		if (polySetVisitMark[PolySetInst(e.polyset, e.m)]++ > 0)
 			continue;
-		Float20 &m = *chain->matrices[i];
+		const float *c = e.color.data();
 		glPushMatrix();
-		glMultMatrixd(m.c_array());
-		int csgmode = chain->types[i] == CSGTerm::TYPE_DIFFERENCE ? PolySet::CSGMODE_DIFFERENCE : PolySet::CSGMODE_NORMAL;
+		glMultMatrixf(e.m.data());
+		int csgmode = e.type == CSGTerm::TYPE_DIFFERENCE ? PolySet::CSGMODE_DIFFERENCE : PolySet::CSGMODE_NORMAL;
 		if (highlight) {
-			chain->polysets[i]->render_surface(PolySet::COLORMODE_HIGHLIGHT, PolySet::csgmode_e(csgmode + 20), m);
+			e.polyset->render_surface(PolySet::COLORMODE_HIGHLIGHT, PolySet::csgmode_e(csgmode + 20), e.mirrored);
 			if (showEdges) {
 				glDisable(GL_LIGHTING);
-				chain->polysets[i]->render_edges(PolySet::COLORMODE_HIGHLIGHT, PolySet::csgmode_e(csgmode + 20));
+				e.polyset->render_edges(PolySet::COLORMODE_HIGHLIGHT, PolySet::csgmode_e(csgmode + 20));
 				glEnable(GL_LIGHTING);
 			}
 		} else if (background) {
-			chain->polysets[i]->render_surface(PolySet::COLORMODE_BACKGROUND, PolySet::csgmode_e(csgmode + 10), m);
+			e.polyset->render_surface(PolySet::COLORMODE_BACKGROUND, PolySet::csgmode_e(csgmode + 10), e.mirrored);
 			if (showEdges) {
 				glDisable(GL_LIGHTING);
-				chain->polysets[i]->render_edges(PolySet::COLORMODE_BACKGROUND, PolySet::csgmode_e(csgmode + 10));
+				e.polyset->render_edges(PolySet::COLORMODE_BACKGROUND, PolySet::csgmode_e(csgmode + 10));
 				glEnable(GL_LIGHTING);
 			}
 		} else if (fberror) {
 			if (highlight) {
-				chain->polysets[i]->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode + 20), m);
+				e.polyset->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode + 20), e.mirrored);
 			} else if (background) {
-				chain->polysets[i]->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode + 10), m);
+				e.polyset->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode + 10), e.mirrored);
 			} else {
-				chain->polysets[i]->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), m);
+				e.polyset->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), e.mirrored);
 			}
-		} else if (m[16] >= 0 || m[17] >= 0 || m[18] >= 0 || m[19] >= 0) {
-			glColor4d(m[16], m[17], m[18], m[19]);
-			chain->polysets[i]->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), m);
+		} else if (e.has_color()) {
+			glColor4f(c[0], c[1], c[2], c[3]);
+			e.polyset->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), e.mirrored);
 			if (showEdges) {
 				glDisable(GL_LIGHTING);
-				glColor4d((m[16]+1)/2, (m[17]+1)/2, (m[18]+1)/2, 1.0);
-				chain->polysets[i]->render_edges(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode));
+				glColor4f((c[0]+1)/2, (c[1]+1)/2, (c[2]+1)/2, 1.0);
+				e.polyset->render_edges(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode));
 				glEnable(GL_LIGHTING);
 			}
-		} else if (chain->types[i] == CSGTerm::TYPE_DIFFERENCE) {
-			chain->polysets[i]->render_surface(PolySet::COLORMODE_CUTOUT, PolySet::csgmode_e(csgmode), m);
+		} else if (e.type == CSGTerm::TYPE_DIFFERENCE) {
+			e.polyset->render_surface(PolySet::COLORMODE_CUTOUT, PolySet::csgmode_e(csgmode), e.mirrored);
 			if (showEdges) {
 				glDisable(GL_LIGHTING);
-				chain->polysets[i]->render_edges(PolySet::COLORMODE_CUTOUT, PolySet::csgmode_e(csgmode));
+				e.polyset->render_edges(PolySet::COLORMODE_CUTOUT, PolySet::csgmode_e(csgmode));
 				glEnable(GL_LIGHTING);
 			}
 		} else {
-			chain->polysets[i]->render_surface(PolySet::COLORMODE_MATERIAL, PolySet::csgmode_e(csgmode), m);
+			e.polyset->render_surface(PolySet::COLORMODE_MATERIAL, PolySet::csgmode_e(csgmode), e.mirrored);
 			if (showEdges) {
 				glDisable(GL_LIGHTING);
-				chain->polysets[i]->render_edges(PolySet::COLORMODE_MATERIAL, PolySet::csgmode_e(csgmode));
+				e.polyset->render_edges(PolySet::COLORMODE_MATERIAL, PolySet::csgmode_e(csgmode));
 				glEnable(GL_LIGHTING);
 			}
 		}
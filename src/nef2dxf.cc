@@ -37,7 +37,9 @@ DxfData::DxfData(const struct CGAL_Nef_polyhedron &N)
 	typedef CGAL_Nef_polyhedron2::Explorer Explorer;
 	typedef Explorer::Face_const_iterator fci_t;
 	typedef Explorer::Halfedge_around_face_const_circulator heafcc_t;
-	Explorer E = N.p2.explorer();
+	if (N.dim != 2)
+		return;
+	Explorer E = N.p2->explorer();
 
 	for (fci_t fit = E.faces_begin(), facesend = E.faces_end(); fit != facesend; ++fit)
 	{
@@ -51,22 +53,23 @@ DxfData::DxfData(const struct CGAL_Nef_polyhedron &N)
 				if (grid.has(x, y)) {
 					this_point = grid.align(x, y);
 				} else {
-					this_point = grid.align(x, y) = points.size();
-					points.append(Point(x, y));
+					int &slot = grid.align(x, y);
+					slot = addPoint(x, y);
+					this_point = slot;
 				}
 				if (first_point < 0) {
-					paths.append(Path());
+					paths.push_back(Path());
 					first_point = this_point;
 				}
 				if (this_point != last_point) {
-					paths.last().points.append(&points[this_point]);
+					paths.back().indices.push_back(this_point);
 					last_point = this_point;
 				}
 			}
 		}
 		if (first_point >= 0) {
-			paths.last().is_closed = 1;
-			paths.last().points.append(&points[first_point]);
+			paths.back().is_closed = 1;
+			paths.back().indices.push_back(first_point);
 		}
 	}
 
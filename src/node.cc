@@ -26,43 +26,229 @@
 
 #include "printutils.h"
 #include "node.h"
+#include "transform.h"
 #include "csgterm.h"
 #include "progress.h"
 #include "polyset.h"
-#include <QRegExp>
+#include "dxfdata.h"
+#include "dxftess.h"
+#ifdef ENABLE_CGAL
+#  include "planner.h"
+#  include "export.h" // cgal_nef3_to_polyset()
+#  include <CGAL/assertions_behaviour.h>
+#  include <CGAL/exceptions.h>
+#endif
+#include <QHash>
+#include <algorithm>
 
 int AbstractNode::idx_counter;
 
 AbstractNode::AbstractNode(const Props &p):props(p)
 {
 	idx = idx_counter++;
+	render_engine = ENGINE_NEF;
 }
 
 AbstractNode::AbstractNode(const Props &p, const NodeList &children):children(children),props(p)
 {
 	idx = idx_counter++;
+	render_engine = ENGINE_NEF;
 }
 
 
 AbstractNode::~AbstractNode() {}
 
+/*!
+	Returns a copy of this node with the given children, or NULL if the
+	node can't be copied. Nodes whose parameters are plain members
+	implement this with clone_as().
+*/
+AbstractNode::Pointer AbstractNode::clone_with_children(const NodeList &) const
+{
+	return Pointer();
+}
+
+/*!
+	Returns the hash identifying what this node renders to: its statement
+	and the ids of its children, but not the node indices. Only the hex
+	digest is kept per node, so ids of deep trees stay small.
+*/
 QString AbstractNode::mk_cache_id() const
 {
-	QString cache_id = dump("");
-	cache_id.remove(QRegExp("[a-zA-Z_][a-zA-Z_0-9]*:"));
-	cache_id.remove(' ');
-	cache_id.remove('\t');
-	cache_id.remove('\n');
-	return cache_id;
+	if (id_cache.isEmpty()) {
+		QCryptographicHash hash(QCryptographicHash::Sha1);
+		hash_statement(hash);
+		hash.addData("{", 1);
+		foreach (AbstractNode::Pointer v, children)
+			hash.addData(v->mk_cache_id().toAscii());
+		hash.addData("}", 1);
+		((AbstractNode*)this)->id_cache = hash.result().toHex();
+	}
+	return id_cache;
 }
 
 #ifdef ENABLE_CGAL
 
+/*!
+	Summarizes the size of the exact numbers in N: the maximum and mean
+	bit lengths of the numerators and denominators of all vertex
+	coordinates, next to the vertex and facet counts.
+*/
+static QString nef_telemetry_text(const CGAL_Nef_polyhedron &N, int msecs)
+{
+	int num_max = 0, den_max = 0, coords = 0, vertices = 0, facets = 0;
+	double num_sum = 0, den_sum = 0;
+	if (N.dim == 2) {
+		typedef CGAL_Nef_polyhedron2::Explorer Explorer;
+		Explorer E = N.p2->explorer();
+		for (Explorer::Vertex_const_iterator v = E.vertices_begin(); v != E.vertices_end(); ++v) {
+			if (!E.is_standard(v))
+				continue;
+			Explorer::Point p = E.point(v);
+			CGAL::Gmpq c[2] = { p.x(), p.y() };
+			for (int i = 0; i < 2; i++) {
+				int nb = c[i].numerator().bit_size(), db = c[i].denominator().bit_size();
+				num_max = std::max(num_max, nb), den_max = std::max(den_max, db);
+				num_sum += nb, den_sum += db, coords++;
+			}
+			vertices++;
+		}
+		facets = E.number_of_faces();
+	}
+	if (N.dim == 3) {
+		CGAL_Nef_polyhedron3::Vertex_const_iterator v;
+		for (v = N.p3->vertices_begin(); v != N.p3->vertices_end(); ++v) {
+			const CGAL_Point &p = v->point();
+			CGAL::Gmpq c[3] = { p.x(), p.y(), p.z() };
+			for (int i = 0; i < 3; i++) {
+				int nb = c[i].numerator().bit_size(), db = c[i].denominator().bit_size();
+				num_max = std::max(num_max, nb), den_max = std::max(den_max, db);
+				num_sum += nb, den_sum += db, coords++;
+			}
+			vertices++;
+		}
+		facets = N.p3->number_of_facets();
+	}
+	if (coords == 0)
+		coords = 1;
+	QString text;
+	text.sprintf("%d vertices, %d facets, numerator bits %d max / %.1f mean, "
+			"denominator bits %d max / %.1f mean, %d ms", vertices, facets,
+			num_max, num_sum / coords, den_max, den_sum / coords, msecs);
+	return text;
+}
+
 AbstractNode::cgal_nef_cache_entry::cgal_nef_cache_entry(const CGAL_Nef_polyhedron &N) :
-		N(N), msg(print_messages_stack.last()) { };
+		N(N), msg(print_messages_stack.last())
+{
+	if (cgal_nef_telemetry)
+		telemetry = nef_telemetry_text(N, print_messages_elapsed());
+}
+
+bool AbstractNode::cgal_nef_telemetry = false;
+
+/*!
+	Prints the telemetry recorded for this node and its children, if their
+	results are still in the cache. The times include the children.
+*/
+void AbstractNode::print_cgal_telemetry(QString indent) const
+{
+	QString label = dump_label();
+	QString cache_id = mk_cache_id();
+	if (cgal_nef_cache.contains(cache_id) && !cgal_nef_cache[cache_id]->telemetry.isEmpty())
+		PRINT_NOCACHE(indent + label + ": " + cgal_nef_cache[cache_id]->telemetry);
+	foreach (AbstractNode::Pointer v, children)
+		v->print_cgal_telemetry(indent + "  ");
+}
 
 QCache<QString, AbstractNode::cgal_nef_cache_entry> AbstractNode::cgal_nef_cache(100000);
 
+bool AbstractNode::cgal_nef_snap = false;
+
+static double snap_coord(double x)
+{
+	return floor(x / cgal_quantize_grid + 0.5);
+}
+
+/*!
+	Rounds all vertices of N onto the cgal_quantize_grid, so results of
+	boolean operations don't carry ever growing rationals into the next
+	operation. Each coordinate moves by at most half a grid step. Vertices
+	rounded onto each other are merged and faces collapsing to a line or
+	a point are dropped. If N can't be rebuilt from the rounded vertices,
+	it is returned unchanged.
+*/
+CGAL_Nef_polyhedron AbstractNode::snap_cgal_nef_polyhedron(const CGAL_Nef_polyhedron &N)
+{
+	if (!cgal_nef_snap || cgal_quantize_grid <= 0 || N.dim == 0)
+		return N;
+	// An exactly empty result has nothing to snap
+	if (N.weight() == 0)
+		return N;
+	if (N.dim == 3 && !N.p3->is_simple())
+		return N;
+
+	double g = cgal_quantize_grid;
+	PolySet *ps = new PolySet();
+	CGAL_Nef_polyhedron snapped;
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	try {
+		if (N.dim == 2) {
+			DxfData dd(N);
+			for (size_t i = 0; i < dd.points.size(); i++) {
+				dd.points[i].x = snap_coord(dd.points[i].x) * g;
+				dd.points[i].y = snap_coord(dd.points[i].y) * g;
+			}
+			ps->is2d = true;
+			dxf_tesselate(ps, &dd, 0, true, false, 0);
+		} else {
+			PolySet *tris = new PolySet();
+			try {
+				cgal_nef3_to_polyset(tris, const_cast<CGAL_Nef_polyhedron*>(&N));
+			}
+			catch (...) {
+				tris->unlink();
+				throw;
+			}
+			for (int i = 0; i < tris->polygons.size(); i++) {
+				const PolySet::Polygon &t = tris->polygons[i];
+				double p[3][3];
+				for (int j = 0; j < 3; j++) {
+					p[j][0] = snap_coord(t[j].x);
+					p[j][1] = snap_coord(t[j].y);
+					p[j][2] = snap_coord(t[j].z);
+				}
+				// Coordinates are grid units here, so this test is exact
+				double ux = p[1][0] - p[0][0], uy = p[1][1] - p[0][1], uz = p[1][2] - p[0][2];
+				double vx = p[2][0] - p[0][0], vy = p[2][1] - p[0][1], vz = p[2][2] - p[0][2];
+				if (uy*vz - uz*vy == 0 && uz*vx - ux*vz == 0 && ux*vy - uy*vx == 0)
+					continue;
+				ps->append_poly();
+				for (int j = 0; j < 3; j++)
+					ps->append_vertex(p[j][0] * g, p[j][1] * g, p[j][2] * g);
+			}
+			tris->unlink();
+		}
+		snapped = ps->render_cgal_nef_polyhedron();
+	}
+	catch (CGAL::Failure_exception e) {
+		snapped = CGAL_Nef_polyhedron();
+	}
+	catch (...) { // Don't leak the PolySet on ProgressCancelException
+		CGAL::set_error_behaviour(old_behaviour);
+		ps->unlink();
+		throw;
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+	ps->unlink();
+
+	if (snapped.dim != N.dim || snapped.weight() == 0 || (N.dim == 3 && !snapped.p3->is_simple())) {
+		PRINT("WARNING: Can't snap intermediate result to the grid, keeping it exact.");
+		return N;
+	}
+	return snapped;
+}
+
 static CGAL_Nef_polyhedron render_cgal_nef_polyhedron_backend(const AbstractNode *that, bool intersect)
 {
 	QString cache_id = that->mk_cache_id();
@@ -74,8 +260,23 @@ static CGAL_Nef_polyhedron render_cgal_nef_polyhedron_backend(const AbstractNode
 
 	print_messages_push();
 
-	bool first = true;
 	CGAL_Nef_polyhedron N;
+	if (intersect && that->render_engine == AbstractNode::ENGINE_EMPTY) {
+		N = CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3());
+		that->cgal_nef_cache.insert(cache_id, new AbstractNode::cgal_nef_cache_entry(N), N.weight());
+		that->progress_report();
+		print_messages_pop();
+		return N;
+	}
+	if ((!intersect && that->render_engine == AbstractNode::ENGINE_CONCAT && RenderPlanner::render_concat(that, N)) ||
+			TransformNode::render_cgal_nef_translated(that, intersect ? CSG_TYPE_INTERSECTION : CSG_TYPE_UNION, N)) {
+		that->cgal_nef_cache.insert(cache_id, new AbstractNode::cgal_nef_cache_entry(N), N.weight());
+		that->progress_report();
+		print_messages_pop();
+		return N;
+	}
+
+	bool first = true;
 	foreach (AbstractNode::Pointer v, that->children) {
 		if (v->props.background)
 			continue;
@@ -83,20 +284,16 @@ static CGAL_Nef_polyhedron render_cgal_nef_polyhedron_backend(const AbstractNode
 			N = v->render_cgal_nef_polyhedron();
 			if (N.dim != 0)
 				first = false;
-		} else if (N.dim == 2) {
-			if (intersect)
-				N.p2 *= v->render_cgal_nef_polyhedron().p2;
-			else
-				N.p2 += v->render_cgal_nef_polyhedron().p2;
+		} else if (intersect) {
+			N *= v->render_cgal_nef_polyhedron();
 		} else {
-			if (intersect)
-				N.p3 *= v->render_cgal_nef_polyhedron().p3;
-			else
-				N.p3 += v->render_cgal_nef_polyhedron().p3;
+			N += v->render_cgal_nef_polyhedron();
 		}
 		v->progress_report();
 	}
 
+	if (that->children.size() > 1)
+		N = AbstractNode::snap_cgal_nef_polyhedron(N);
 	that->cgal_nef_cache.insert(cache_id, new AbstractNode::cgal_nef_cache_entry(N), N.weight());
 	that->progress_report();
 	print_messages_pop();
@@ -149,26 +346,59 @@ CSGTerm *AbstractIntersectionNode::render_csg_term(const Float20 &m, QVector<CSG
 	return render_csg_term_backend(this, true, m, highlights, background);
 }
 
-QString AbstractNode::dump(QString indent) const
+/*!
+	Writes the tree below this node to out. Nothing is kept, so dumping
+	a large tree costs no memory beyond the stream's.
+*/
+void AbstractNode::dump(QTextStream &out, QString indent) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text = indent + QString("n%1: group() {\n").arg(idx);
-		foreach (AbstractNode::Pointer v, children)
-			text += v->dump(indent + QString("\t"));
-		((AbstractNode*)this)->dump_cache = text + indent + "}\n";
+	out << indent << "n" << idx << ": ";
+	dump_statement(out);
+	if (children.isEmpty()) {
+		out << ";\n";
+		return;
 	}
-	return dump_cache;
+	out << " {\n";
+	foreach (AbstractNode::Pointer v, children)
+		v->dump(out, indent + QString("\t"));
+	out << indent << "}\n";
 }
 
-QString AbstractIntersectionNode::dump(QString indent) const
+/*!
+	Returns the first line of the dump of this node, e.g. "n3: union()"
+*/
+QString AbstractNode::dump_label() const
 {
-	if (dump_cache.isEmpty()) {
-		QString text = indent + QString("n%1: intersection() {\n").arg(idx);
-		foreach (AbstractNode::Pointer v, children)
-			text += v->dump(indent + QString("\t"));
-		((AbstractNode*)this)->dump_cache = text + indent + "}\n";
-	}
-	return dump_cache;
+	QString label;
+	QTextStream out(&label);
+	out << "n" << idx << ": ";
+	dump_statement(out);
+	out.flush();
+	return label;
+}
+
+void AbstractNode::dump_statement(QTextStream &out) const
+{
+	out << "group()";
+}
+
+/*!
+	Adds what identifies this node apart from its children to hash. By
+	default that is the statement as dumped. Nodes with large numeric
+	parameters override this to add them in binary instead.
+*/
+void AbstractNode::hash_statement(QCryptographicHash &hash) const
+{
+	QString text;
+	QTextStream out(&text);
+	dump_statement(out);
+	out.flush();
+	hash.addData(text.toUtf8());
+}
+
+void AbstractIntersectionNode::dump_statement(QTextStream &out) const
+{
+	out << "intersection()";
 }
 
 void AbstractNode::progress_prepare()
@@ -185,6 +415,30 @@ void AbstractNode::progress_report() const
 
 #ifdef ENABLE_CGAL
 
+/*!
+	Returns the PolySet of this node as it is, cached by its own cache id
+	so that all placements of the same object share it. Returns NULL if
+	the node has none, e.g. because its data file can't be read.
+*/
+PolySet *AbstractPolyNode::render_cached_polyset() const
+{
+	QString key = mk_cache_id();
+	if (PolySet::ps_pinned.contains(key)) {
+		PRINT(PolySet::ps_pinned[key]->msg);
+		return PolySet::ps_pinned[key]->ps->link();
+	}
+	if (PolySet::ps_cache.contains(key)) {
+		PRINT(PolySet::ps_cache[key]->msg);
+		return PolySet::ps_cache[key]->ps->link();
+	}
+	print_messages_push();
+	PolySet *ps = render_polyset(RENDER_CGAL);
+	if (ps && !PolySet::ps_cache.contains(key))
+		PolySet::ps_cache.insert(key, new PolySet::ps_cache_entry(ps->link()));
+	print_messages_pop();
+	return ps;
+}
+
 CGAL_Nef_polyhedron AbstractPolyNode::render_cgal_nef_polyhedron() const
 {
 	QString cache_id = mk_cache_id();
@@ -214,9 +468,71 @@ CGAL_Nef_polyhedron AbstractPolyNode::render_cgal_nef_polyhedron() const
 
 #endif /* ENABLE_CGAL */
 
+/*!
+	PolySets of the OpenCSG products of the current and the previous
+	compile, by cache id. Primitives that did not change since the previous
+	compile take their PolySet from there instead of being tessellated again.
+*/
+static QHash<QString, PolySet*> csg_polysets, csg_polysets_previous;
+static int csg_polysets_reused, csg_polysets_rendered;
+
+/*!
+	Starts a new compile of CSG products. The PolySets of the last one
+	stay available for reuse until end_csg_generation().
+*/
+void AbstractPolyNode::begin_csg_generation()
+{
+	foreach (PolySet *ps, csg_polysets_previous)
+		ps->unlink();
+	csg_polysets_previous = csg_polysets;
+	csg_polysets.clear();
+	csg_polysets_reused = 0;
+	csg_polysets_rendered = 0;
+}
+
+/*!
+	Releases the PolySets of the previous compile that were not reused.
+*/
+void AbstractPolyNode::end_csg_generation()
+{
+	foreach (PolySet *ps, csg_polysets_previous)
+		ps->unlink();
+	csg_polysets_previous.clear();
+	if (csg_polysets_reused > 0)
+		PRINTF("Reused %d of %d primitives from the previous compile.", csg_polysets_reused, csg_polysets_reused + csg_polysets_rendered);
+}
+
+/*!
+	Forgets the PolySets of the current and the previous compile, so the
+	next compile tessellates all primitives again.
+*/
+void AbstractPolyNode::flush_csg_polysets()
+{
+	foreach (PolySet *ps, csg_polysets)
+		ps->unlink();
+	csg_polysets.clear();
+	foreach (PolySet *ps, csg_polysets_previous)
+		ps->unlink();
+	csg_polysets_previous.clear();
+}
+
 CSGTerm *AbstractPolyNode::render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const
 {
-	PolySet *ps = render_polyset(RENDER_OPENCSG);
+	QString key = mk_cache_id();
+	PolySet *ps;
+	if (csg_polysets.contains(key)) {
+		ps = csg_polysets[key]->link();
+	} else if (csg_polysets_previous.contains(key)) {
+		ps = csg_polysets_previous.take(key);
+		csg_polysets.insert(key, ps);
+		ps->link();
+		csg_polysets_reused++;
+	} else {
+		ps = render_polyset(RENDER_OPENCSG);
+		if (ps)
+			csg_polysets.insert(key, ps->link());
+		csg_polysets_rendered++;
+	}
 	return render_csg_term_from_ps(m, highlights, background, ps, props, idx);
 }
 
@@ -3,6 +3,8 @@
 
 #include <QCache>
 #include <QVector>
+#include <QTextStream>
+#include <QCryptographicHash>
 
 #ifdef ENABLE_CGAL
 #include "cgal.h"
@@ -43,8 +45,17 @@ public:
 	void progress_prepare();
 	void progress_report() const;
 
+	enum render_engine_e {
+		ENGINE_NEF,
+		ENGINE_CACHED,
+		ENGINE_CONCAT,
+		ENGINE_MESH,
+		ENGINE_EMPTY
+	};
+	render_engine_e render_engine; // chosen by the RenderPlanner
+
 	int idx;
-	QString dump_cache;
+	QString id_cache;  // must be cleared when the children change
 
 	AbstractNode(const Props &p);
 	AbstractNode(const Props &p, const NodeList &children);
@@ -54,14 +65,38 @@ public:
 	struct cgal_nef_cache_entry {
 		CGAL_Nef_polyhedron N;
 		QString msg;
+		QString telemetry;
 		cgal_nef_cache_entry(const CGAL_Nef_polyhedron &N);
 	};
 	static QCache<QString, cgal_nef_cache_entry> cgal_nef_cache;
+	static bool cgal_nef_telemetry;
+	void print_cgal_telemetry(QString indent = QString()) const;
+	static bool cgal_nef_snap;
+	static CGAL_Nef_polyhedron snap_cgal_nef_polyhedron(const CGAL_Nef_polyhedron &N);
 	virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
 	class CSGTerm *render_csg_term_from_nef(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background, const char *statement, int convexity) const;
 #endif
 	virtual class CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
-	virtual QString dump(QString indent) const;
+	void dump(QTextStream &out, QString indent) const;
+	QString dump_label() const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual void hash_statement(QCryptographicHash &hash) const;
+	virtual Pointer clone_with_children(const NodeList &children) const;
+
+protected:
+	/*!
+		Copies node with other children. The copy is a node of its own,
+		with its own index and cache id.
+	*/
+	template <class T>
+	static Pointer clone_as(const T *node, const NodeList &children) {
+		shared_ptr<T> n(new T(*node));
+		n->children = children;
+		n->idx = idx_counter++;
+		n->id_cache = QString();
+		n->render_engine = ENGINE_NEF;
+		return n;
+	}
 };
 
 class AbstractIntersectionNode : public AbstractNode
@@ -72,7 +107,7 @@ public:
 	virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
 #endif
 	virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
 };
 
 class AbstractPolyNode : public AbstractNode
@@ -86,9 +121,13 @@ public:
 	AbstractPolyNode(const Props &p, const NodeList &children): AbstractNode(p, children) { };
 	virtual class PolySet *render_polyset(render_mode_e mode) const = 0;
 #ifdef ENABLE_CGAL
+	PolySet *render_cached_polyset() const;
 	virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
 #endif
 	virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
+	static void begin_csg_generation();
+	static void end_csg_generation();
+	static void flush_csg_polysets();
 	static CSGTerm *render_csg_term_from_ps(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background, PolySet *ps, const Props &p, int idx);
 };
 
@@ -0,0 +1,244 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "offset.h"
+#include "printutils.h"
+#include "dxfdata.h"
+#include "grid.h"
+#include "progress.h"
+#include "openscad.h" // get_fragments_from_r()
+#ifdef ENABLE_CGAL
+#  include "cgal.h"
+#  include <CGAL/assertions_behaviour.h>
+#  include <CGAL/exceptions.h>
+#endif
+
+#include <QList>
+
+#ifdef ENABLE_CGAL
+
+/*
+	The offset of a region is the region plus (or minus, for insets) the
+	band of all points within the offset distance of its boundary. This band
+	is the union of one rectangle per boundary edge and one wedge per corner
+	on the convex side of the corner, which makes it work the same for outer
+	boundaries and holes.
+*/
+
+struct offset_vec_t {
+	double x, y;
+	offset_vec_t() : x(0), y(0) { }
+	offset_vec_t(double x, double y) : x(x), y(y) { }
+	offset_vec_t operator+(const offset_vec_t &o) const { return offset_vec_t(x + o.x, y + o.y); }
+	offset_vec_t operator-(const offset_vec_t &o) const { return offset_vec_t(x - o.x, y - o.y); }
+	offset_vec_t operator*(double f) const { return offset_vec_t(x * f, y * f); }
+};
+
+static void add_piece(QList<CGAL_Nef_polyhedron2> &pieces, const QList<offset_vec_t> &poly)
+{
+	double area = 0;
+	for (int i = 0; i < poly.size(); i++) {
+		const offset_vec_t &a = poly[i], &b = poly[(i+1) % poly.size()];
+		area += a.x * b.y - b.x * a.y;
+	}
+	if (fabs(area) < GRID_FINE * GRID_FINE)
+		return;
+
+	std::list<CGAL_Nef_polyhedron2::Point> plist;
+	for (int i = 0; i < poly.size(); i++) {
+		const offset_vec_t &p = poly[area > 0 ? i : poly.size() - 1 - i];
+		plist.push_back(CGAL_Nef_polyhedron2::Point(cgal_quantize(p.x), cgal_quantize(p.y)));
+	}
+	pieces.append(CGAL_Nef_polyhedron2(plist.begin(), plist.end(), CGAL_Nef_polyhedron2::INCLUDED));
+}
+
+static void add_edge_piece(QList<CGAL_Nef_polyhedron2> &pieces, const offset_vec_t &a, const offset_vec_t &b, double d)
+{
+	offset_vec_t e = b - a;
+	double len = sqrt(e.x*e.x + e.y*e.y);
+	if (len == 0)
+		return;
+	offset_vec_t n = offset_vec_t(-e.y / len, e.x / len) * d;
+	QList<offset_vec_t> poly;
+	poly << a - n << b - n << b + n << a + n;
+	add_piece(pieces, poly);
+}
+
+/*!
+	Longest miter allowed, as a multiple of the offset distance. Only
+	corners sharper than about a tenth of a degree reach it. Their miter
+	would be a meaningless spike, so they are beveled instead. All other
+	corners keep their true miter.
+*/
+static const double miter_limit = 1000.0;
+
+/*!
+	The miter at a corner whose edge normals have the dot product dot is
+	1/cos(angle/2) = sqrt(2/(1+dot)) times the offset distance long.
+*/
+static bool miter_ok(double dot)
+{
+	return (1 + dot) * miter_limit * miter_limit >= 2;
+}
+
+static void add_corner_piece(QList<CGAL_Nef_polyhedron2> &pieces, const offset_vec_t &prev,
+		const offset_vec_t &v, const offset_vec_t &next, double d,
+		OffsetNode::join_type_e join_type, int fragments)
+{
+	offset_vec_t e1 = v - prev, e2 = next - v;
+	double l1 = sqrt(e1.x*e1.x + e1.y*e1.y), l2 = sqrt(e2.x*e2.x + e2.y*e2.y);
+	if (l1 == 0 || l2 == 0)
+		return;
+	offset_vec_t n1(-e1.y / l1, e1.x / l1), n2(-e2.y / l2, e2.x / l2);
+
+	// The rectangles of the two edges leave a gap on the outer side of the
+	// turn, i.e. right of a left turn and vice versa.
+	double cross = n1.x * n2.y - n1.y * n2.x;
+	double dot = n1.x * n2.x + n1.y * n2.y;
+	if (cross == 0)
+		return;
+	double side = cross > 0 ? -d : d;
+	offset_vec_t o1 = v + n1 * side, o2 = v + n2 * side;
+
+	QList<offset_vec_t> poly;
+	poly << v << o1;
+	if (join_type == OffsetNode::JOIN_MITER && miter_ok(dot)) {
+		poly << v + (n1 + n2) * (side / (1 + dot));
+	} else if (join_type == OffsetNode::JOIN_ROUND) {
+		double a1 = atan2(o1.y - v.y, o1.x - v.x);
+		double sweep = atan2(cross, dot);
+		int segments = (int)ceil(fabs(sweep) * fragments / (2*M_PI));
+		for (int i = 1; i < segments; i++) {
+			double a = a1 + sweep * i / segments;
+			poly << offset_vec_t(v.x + fabs(d) * cos(a), v.y + fabs(d) * sin(a));
+		}
+	}
+	poly << o2;
+	add_piece(pieces, poly);
+}
+
+CGAL_Nef_polyhedron OffsetNode::render_cgal_nef_polyhedron() const
+{
+	QString cache_id = mk_cache_id();
+	if (cgal_nef_cache.contains(cache_id)) {
+		progress_report();
+		PRINT(cgal_nef_cache[cache_id]->msg);
+		return cgal_nef_cache[cache_id]->N;
+	}
+
+	print_messages_push();
+
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	CGAL_Nef_polyhedron N = CGAL_Nef_polyhedron2();
+	try {
+	foreach (AbstractNode::Pointer v, children) {
+		if (v->props.background)
+			continue;
+		CGAL_Nef_polyhedron tmp = v->render_cgal_nef_polyhedron();
+		if (tmp.dim == 3)
+			PRINT("WARNING: offset() is only implemented for 2D objects, ignoring 3D child!");
+		N += tmp;
+		v->progress_report();
+	}
+
+	double d = fabs(delta);
+	if (d >= GRID_FINE)
+	{
+		int fragments = std::max(get_fragments_from_r(d, *this), 3);
+		DxfData dd(N);
+
+		QList<CGAL_Nef_polyhedron2> pieces;
+		for (size_t i = 0; i < dd.paths.size(); i++)
+		{
+			const DxfData::Path &pt = dd.paths[i];
+			int n = pt.indices.size() - (pt.is_closed ? 1 : 0);
+			for (int j = 0; j < n; j++) {
+				const DxfData::Point &p1 = dd.point(pt, j), &p2 = dd.point(pt, (j+1) % n);
+				add_edge_piece(pieces, offset_vec_t(p1.x, p1.y), offset_vec_t(p2.x, p2.y), d);
+			}
+			for (int j = 0; j < n; j++) {
+				const DxfData::Point &p0 = dd.point(pt, (j+n-1) % n), &p1 = dd.point(pt, j), &p2 = dd.point(pt, (j+1) % n);
+				add_corner_piece(pieces, offset_vec_t(p0.x, p0.y), offset_vec_t(p1.x, p1.y),
+						offset_vec_t(p2.x, p2.y), d, join_type, fragments);
+			}
+		}
+
+		// Merge the pieces pairwise, which keeps the intermediate results small
+		while (pieces.size() > 1) {
+			QList<CGAL_Nef_polyhedron2> merged;
+			for (int i = 0; i+1 < pieces.size(); i += 2)
+				merged.append(pieces[i] + pieces[i+1]);
+			if (pieces.size() % 2)
+				merged.append(pieces.last());
+			pieces = merged;
+		}
+
+		if (!pieces.isEmpty()) {
+			if (delta > 0)
+				N += pieces.first();
+			else
+				N -= pieces.first();
+		}
+	}
+	cgal_nef_cache.insert(cache_id, new cgal_nef_cache_entry(N), N.weight());
+	}
+	catch (CGAL::Assertion_exception e) {
+		PRINTF("ERROR: CGAL error in offset(). Skipping affected object.");
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+
+	print_messages_pop();
+	progress_report();
+
+	return N;
+}
+
+CSGTerm *OffsetNode::render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const
+{
+	return render_csg_term_from_nef(m, highlights, background, "offset", this->convexity);
+}
+
+#else // ENABLE_CGAL
+
+CSGTerm *OffsetNode::render_csg_term(const Float20 &, QVector<CSGTerm*> *, QVector<CSGTerm*> *) const
+{
+	PRINT("WARNING: Found offset() statement but compiled without CGAL support!");
+	return NULL;
+}
+
+#endif // ENABLE_CGAL
+
+void OffsetNode::dump_statement(QTextStream &out) const
+{
+	QString text;
+	if (join_type == JOIN_ROUND)
+		text.sprintf("offset(r = %g, $fn = %g, $fa = %g, $fs = %g, convexity = %d)",
+				delta, fn, fa, fs, convexity);
+	else
+		text.sprintf("offset(delta = %g, chamfer = %s, convexity = %d)",
+				delta, join_type == JOIN_CHAMFER ? "true" : "false", convexity);
+	out << text;
+}
@@ -0,0 +1,64 @@
+#ifndef OFFSET_H_
+#define OFFSET_H_
+
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "node.h"
+#include "accuracy.h"
+
+/*!
+	Offsets (outsets for positive, insets for negative distances) the union
+	of its 2D children. Round offsets approximate the arcs at the corners
+	according to $fn, $fs and $fa, delta offsets keep the corners sharp or
+	chamfer them.
+*/
+class OffsetNode : public AbstractNode, public Accuracy
+{
+public:
+	typedef shared_ptr<OffsetNode> Pointer;
+	enum join_type_e {
+		JOIN_ROUND,
+		JOIN_MITER,
+		JOIN_CHAMFER
+	};
+	double delta;
+	join_type_e join_type;
+	int convexity;
+	OffsetNode(const AbstractNode::NodeList &children, double delta, join_type_e join_type,
+		   int convexity, const Accuracy &acc=Accuracy(), const Props p=Props())
+	  : AbstractNode(p, children), Accuracy(acc), delta(delta), join_type(join_type), convexity(convexity) {}
+#ifdef ENABLE_CGAL
+	virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
+#endif
+	virtual CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+		return clone_as(this, children);
+	}
+};
+
+#endif
@@ -27,7 +27,12 @@
 #include "openscad.h"
 #include "MainWindow.h"
 #include "node.h"
+#include "transform.h"
+#include "optimizer.h"
+#include "planner.h"
+#include "gmppool.h"
 #include "export.h"
+#include "grid.h"
 
 #include <string>
 #include <vector>
@@ -58,8 +63,9 @@ namespace po = boost::program_options;
 static void help(const char *progname)
 {
 	fprintf(stderr, "Usage: %s [ { -s stl_file | -o off_file | -x dxf_file } [ -d deps_file ] ]\\\n"
-					"%*s[ -m make_command ] [ -D var=val [..] ] filename\n",
-					progname, int(strlen(progname))+8, "");
+					"%*s[ -m make_command ] [ -D var=val [..] ]\\\n"
+					"%*s[ -q grid ] [ -S ] [ -R tolerance ] [ -T ] [ --no-optimize ] [ --no-plan ] [ --explain ] [ --gmp-pool ] filename\n",
+					progname, int(strlen(progname))+8, "", int(strlen(progname))+8, "");
 	exit(1);
 }
 
@@ -140,7 +146,15 @@ int main(int argc, char **argv)
 		("x,x", po::value<string>(), "dxf-file")
 		("d,d", po::value<string>(), "deps-file")
 		("m,m", po::value<string>(), "makefile")
-		("D,D", po::value<vector<string> >(), "var=val");
+		("D,D", po::value<vector<string> >(), "var=val")
+		("q,q", po::value<string>(), "quantize-grid")
+		("S,S", "snap-intermediate")
+		("R,R", po::value<double>(), "rotation-tolerance")
+		("T,T", "telemetry")
+		("no-optimize", "disable the tree optimizer")
+		("no-plan", "disable the render planner")
+		("explain", "print the render plan")
+		("gmp-pool", "recycle the memory of exact numbers");
 
 	po::options_description hidden("Hidden options");
 	hidden.add_options()
@@ -194,6 +208,46 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (vm.count("q")) {
+#ifdef ENABLE_CGAL
+		if (!cgal_set_quantize_grid(vm["q"].as<string>()))
+			help(argv[0]);
+#endif
+	}
+	if (vm.count("S")) {
+#ifdef ENABLE_CGAL
+		AbstractNode::cgal_nef_snap = true;
+		if (cgal_quantize_grid == 0)
+			cgal_set_quantize_grid("0.000001"); // GRID_FINE
+#endif
+	}
+
+	if (vm.count("T")) {
+#ifdef ENABLE_CGAL
+		AbstractNode::cgal_nef_telemetry = true;
+#endif
+	}
+
+	if (vm.count("no-optimize"))
+		TreeOptimizer::enabled = false;
+
+#ifdef ENABLE_CGAL
+	if (vm.count("no-plan"))
+		RenderPlanner::enabled = false;
+	if (vm.count("explain"))
+		RenderPlanner::explain = true;
+	if (vm.count("gmp-pool")) {
+		GmpPool::enabled = true;
+		GmpPool::install();
+	}
+#endif
+
+	if (vm.count("R")) {
+		TransformNode::rotation_tolerance = vm["R"].as<double>();
+		if (TransformNode::rotation_tolerance < 0)
+			help(argv[0]);
+	}
+
 	if (vm.count("input-file")) {
 		filename = vm["input-file"].as< vector<string> >().begin()->c_str();
 	}
@@ -274,10 +328,25 @@ int main(int argc, char **argv)
 			root_node = pyvm.evaluate((text+commandline_commands).toStdString(), fileInfo.absolutePath().toStdString());
 			if (!root_node) {
 			  fprintf(stderr, "Python error:%s", pyvm.error().c_str());
+			} else if (TreeOptimizer::enabled) {
+				TreeOptimizer optimizer;
+				root_node = optimizer.optimize(root_node);
+				optimizer.print_report();
 			}
 		}
+		RenderPlanner planner;
+		if (root_node && RenderPlanner::enabled) {
+			planner.plan(root_node.get());
+			planner.print_report();
+			if (RenderPlanner::explain)
+				planner.print_plan(root_node.get());
+		}
 		CGAL_Nef_polyhedron *root_N;
 		root_N = new CGAL_Nef_polyhedron(root_node->render_cgal_nef_polyhedron());
+		if (AbstractNode::cgal_nef_telemetry)
+			root_node->print_cgal_telemetry();
+		GmpPool::print_report();
+		GmpPool::trim();
 
 		QDir::setCurrent(original_path.absolutePath());
 
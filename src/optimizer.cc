@@ -0,0 +1,275 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "optimizer.h"
+#include "csgops.h"
+#include "transform.h"
+#include "printutils.h"
+
+#include <QSet>
+#include <typeinfo>
+#include <algorithm>
+#include <boost/make_shared.hpp>
+using boost::make_shared;
+
+bool TreeOptimizer::enabled = true;
+
+TreeOptimizer::TreeOptimizer() :
+		flattened_unions(0), flattened_intersections(0), folded_transforms(0),
+		removed_identities(0), removed_empty(0), reordered_intersections(0)
+{
+}
+
+static bool has_modifiers(const AbstractNode *node)
+{
+	return node->props.root || node->props.highlight || node->props.background;
+}
+
+static bool is_union(const AbstractNode *node)
+{
+	if (typeid(*node) == typeid(AbstractNode))
+		return true;
+	const CsgNode *cn = dynamic_cast<const CsgNode*>(node);
+	return cn && cn->type == CSG_TYPE_UNION;
+}
+
+static bool is_intersection(const AbstractNode *node)
+{
+	if (typeid(*node) == typeid(AbstractIntersectionNode))
+		return true;
+	const CsgNode *cn = dynamic_cast<const CsgNode*>(node);
+	return cn && cn->type == CSG_TYPE_INTERSECTION;
+}
+
+static bool is_difference(const AbstractNode *node)
+{
+	const CsgNode *cn = dynamic_cast<const CsgNode*>(node);
+	return cn && cn->type == CSG_TYPE_DIFFERENCE;
+}
+
+static bool has_color(const TransformNode *tn)
+{
+	return tn->m[16] >= 0 || tn->m[17] >= 0 || tn->m[18] >= 0 || tn->m[19] >= 0;
+}
+
+static bool moves(const TransformNode *tn)
+{
+	for (int i = 0; i < 16; i++)
+		if (tn->m[i] != (i % 5 == 0 ? 1.0 : 0.0))
+			return true;
+	return false;
+}
+
+static bool is_identity(const TransformNode *tn)
+{
+	return !moves(tn) && !has_color(tn);
+}
+
+static bool has_rational_rotation(const TransformNode *tn)
+{
+	for (int i = 0; i < 4; i++)
+		if (tn->rational_q[i] != 0)
+			return true;
+	return false;
+}
+
+struct size_index_t {
+	int size, index;
+	bool operator<(const size_index_t &o) const { return size < o.size; }
+};
+
+int TreeOptimizer::estimate_size(const AbstractNode *node)
+{
+	if (sizes.contains(node))
+		return sizes[node];
+	int size = 1;
+	foreach (AbstractNode::Pointer v, node->children)
+		size += estimate_size(v.get());
+	sizes[node] = size;
+	return size;
+}
+
+AbstractNode::Pointer TreeOptimizer::optimize(const AbstractNode::Pointer &root)
+{
+	AbstractNode::Pointer result = optimize_node(root);
+	return result ? result : root;
+}
+
+/*!
+	Returns the optimized replacement for node, node itself if nothing
+	could be improved, or NULL if the subtree turned out to be empty.
+	The input tree is never changed.
+*/
+AbstractNode::Pointer TreeOptimizer::optimize_node(const AbstractNode::Pointer &node)
+{
+	if (optimized.contains(node.get()))
+		return optimized[node.get()];
+
+	AbstractNode::NodeList children;
+	bool changed = false, first_empty = false, any_empty = false;
+	for (int i = 0; i < node->children.size(); i++) {
+		AbstractNode::Pointer c = optimize_node(node->children[i]);
+		if (c != node->children[i])
+			changed = true;
+		if (c)
+			children.append(c);
+		else {
+			any_empty = true;
+			if (i == 0)
+				first_empty = true;
+		}
+	}
+
+	AbstractNode::Pointer result = node;
+	bool plain = !has_modifiers(node.get());
+
+	if (is_union(node.get()) || is_intersection(node.get()))
+	{
+		bool intersect = is_intersection(node.get());
+		AbstractNode::NodeList flat;
+		foreach (AbstractNode::Pointer c, children) {
+			if (!has_modifiers(c.get()) && (intersect ? is_intersection(c.get()) : is_union(c.get()))) {
+				flat += c->children;
+				(intersect ? flattened_intersections : flattened_unions)++;
+				changed = true;
+			} else {
+				flat.append(c);
+			}
+		}
+		children = flat;
+
+		// Smaller operands first keep the intermediate results small
+		if (intersect && children.size() > 1) {
+			std::vector<size_index_t> order(children.size());
+			for (int i = 0; i < children.size(); i++) {
+				order[i].size = estimate_size(children[i].get());
+				order[i].index = i;
+			}
+			std::stable_sort(order.begin(), order.end());
+			AbstractNode::NodeList sorted;
+			for (int i = 0; i < (int)order.size(); i++)
+				sorted.append(children[order[i].index]);
+			if (sorted != children) {
+				children = sorted;
+				reordered_intersections++;
+				changed = true;
+			}
+		}
+
+		// An empty operand empties the whole intersection
+		if (children.isEmpty() || (intersect && any_empty)) {
+			removed_empty++;
+			result.reset();
+		} else if (children.size() == 1 && plain) {
+			(intersect ? flattened_intersections : flattened_unions)++;
+			result = children[0];
+		} else if (changed) {
+			if (const CsgNode *cn = dynamic_cast<const CsgNode*>(node.get())) {
+				result = make_shared<CsgNode>(cn->type, children, node->props);
+			} else if (intersect) {
+				result = make_shared<AbstractIntersectionNode>(node->props);
+				result->children = children;
+			} else {
+				result = make_shared<AbstractNode>(node->props, children);
+			}
+		}
+	}
+	else if (is_difference(node.get()))
+	{
+		if (first_empty || children.isEmpty()) {
+			removed_empty++;
+			result.reset();
+		} else if (children.size() == 1 && plain) {
+			result = children[0];
+		} else if (changed) {
+			result = make_shared<CsgNode>(CSG_TYPE_DIFFERENCE, children, node->props);
+		}
+	}
+	else if (const TransformNode *tn = dynamic_cast<const TransformNode*>(node.get()))
+	{
+		shared_ptr<TransformNode> t;
+		const TransformNode *inner = children.size() == 1 ? dynamic_cast<const TransformNode*>(children[0].get()) : NULL;
+		// A colored node must not be folded into a movement, since a
+		// TransformNode is dumped and hashed as either a color or a matrix
+		if (inner && !has_modifiers(inner) && !has_rational_rotation(tn) && !has_rational_rotation(inner) &&
+				!((has_color(tn) || has_color(inner)) && (moves(tn) || moves(inner)))) {
+			t = make_shared<TransformNode>(inner->children, node->props);
+			for (int i = 0; i < 16; i++) {
+				t->m[i] = 0;
+				for (int k = 0; k < 4; k++)
+					t->m[i] += tn->m[i%4 + k*4] * inner->m[k + (i/4)*4];
+			}
+			// The inner color wins, as in render_csg_term()
+			for (int i = 16; i < 20; i++)
+				t->m[i] = inner->m[i] < 0 ? tn->m[i] : inner->m[i];
+			folded_transforms++;
+			tn = t.get();
+			children = t->children;
+			changed = true;
+		}
+
+		if (children.isEmpty()) {
+			removed_empty++;
+			result.reset();
+		} else if (plain && is_identity(tn)) {
+			removed_identities++;
+			if (children.size() == 1)
+				result = children[0];
+			else
+				result = make_shared<AbstractNode>(AbstractNode::Props(), children);
+		} else if (t) {
+			result = t;
+		} else if (changed) {
+			t = make_shared<TransformNode>(children, node->props);
+			t->m = tn->m;
+			for (int i = 0; i < 4; i++)
+				t->rational_q[i] = tn->rational_q[i];
+			result = t;
+		}
+	}
+	else if (changed)
+	{
+		// Other nodes are copied with their optimized children, nodes
+		// that can't be copied keep their original ones
+		AbstractNode::Pointer copy = node->clone_with_children(children);
+		if (copy)
+			result = copy;
+	}
+
+	optimized[node.get()] = result;
+	return result;
+}
+
+void TreeOptimizer::print_report() const
+{
+	if (flattened_unions == 0 && flattened_intersections == 0 && folded_transforms == 0 &&
+			removed_identities == 0 && removed_empty == 0 && reordered_intersections == 0)
+		return;
+	PRINTF("Tree optimizer: flattened %d unions and %d intersections, folded %d transformations, "
+			"removed %d identity transformations and %d empty nodes, reordered %d intersections.",
+			flattened_unions, flattened_intersections, folded_transforms,
+			removed_identities, removed_empty, reordered_intersections);
+}
@@ -0,0 +1,67 @@
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "node.h"
+#include <QHash>
+#include <QSet>
+
+/*!
+	Rewrites a node tree into an equivalent one that is cheaper to render:
+	nested unions and intersections are flattened, chains of
+	transformations are folded into one matrix, identity transformations
+	and empty groups are removed and intersection operands are ordered by
+	their estimated size. Nodes carrying modifiers (!, #, %) are kept as
+	they are, only their children are optimized. Unchanged subtrees are
+	shared with the input tree.
+*/
+class TreeOptimizer
+{
+public:
+	static bool enabled;
+
+	TreeOptimizer();
+	AbstractNode::Pointer optimize(const AbstractNode::Pointer &root);
+	void print_report() const;
+
+	int flattened_unions;
+	int flattened_intersections;
+	int folded_transforms;
+	int removed_identities;
+	int removed_empty;
+	int reordered_intersections;
+
+private:
+	AbstractNode::Pointer optimize_node(const AbstractNode::Pointer &node);
+	int estimate_size(const AbstractNode *node);
+
+	QHash<const AbstractNode*, AbstractNode::Pointer> optimized;
+	QHash<const AbstractNode*, int> sizes;
+};
+
+#endif
@@ -0,0 +1,696 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef ENABLE_CGAL
+
+#include "planner.h"
+#include "csgops.h"
+#include "transform.h"
+#include "cgaladv.h"
+#include "polyset.h"
+#include "printutils.h"
+#include "grid.h"
+#include <CGAL/assertions_behaviour.h>
+#include <CGAL/exceptions.h>
+
+#include <typeinfo>
+#include <algorithm>
+#include <math.h>
+
+bool RenderPlanner::enabled = true;
+bool RenderPlanner::explain = false;
+
+// Initial guess, replaced by measurements once something was rendered
+double RenderPlanner::msecs_per_unit = 0.05;
+
+// Relative weights of the cost model
+static const double COST_BUILD = 1.0;     // Nef polyhedron from a mesh, per f*log(f)
+static const double COST_OP = 4.0;        // boolean operation, per (a+b)*log(a+b)
+static const double COST_TRANSFORM = 2.0; // exact transformation, per facet
+static const double COST_MESH = 0.05;     // moving mesh vertices in doubles, per facet
+static const double COST_2D = 0.3;        // 2D operations relative to 3D ones
+
+static const char *engine_names[] = { "nef", "cached", "concat", "mesh", "empty" };
+
+static double nlogn(double n)
+{
+	return n * log(n + 2) / log(2.0);
+}
+
+static double bits_factor(double bits)
+{
+	return std::max(0.5, bits / 53);
+}
+
+/*!
+	Size of the numerators of coordinates read from doubles. With a
+	quantization grid they only need to cover the extent in grid steps.
+*/
+static double input_bits(const RenderPlanner::plan_t &p)
+{
+	if (cgal_quantize_grid <= 0 || !p.has_bbox)
+		return 53;
+	double extent = 1;
+	for (int i = 0; i < 3; i++)
+		extent = std::max(extent, std::max(fabs(p.bbox[i]), fabs(p.bbox[i+3])));
+	return std::min(53.0, log(extent / cgal_quantize_grid + 1) / log(2.0) + 1);
+}
+
+static bool is_union(const AbstractNode *node)
+{
+	if (typeid(*node) == typeid(AbstractNode))
+		return true;
+	const CsgNode *cn = dynamic_cast<const CsgNode*>(node);
+	return cn && cn->type == CSG_TYPE_UNION;
+}
+
+static bool is_intersection(const AbstractNode *node)
+{
+	if (dynamic_cast<const AbstractIntersectionNode*>(node))
+		return true;
+	const CsgNode *cn = dynamic_cast<const CsgNode*>(node);
+	return cn && cn->type == CSG_TYPE_INTERSECTION;
+}
+
+static bool is_difference(const AbstractNode *node)
+{
+	const CsgNode *cn = dynamic_cast<const CsgNode*>(node);
+	return cn && cn->type == CSG_TYPE_DIFFERENCE;
+}
+
+static void merge_bbox(double *bbox, const double *other)
+{
+	for (int i = 0; i < 3; i++) {
+		bbox[i] = std::min(bbox[i], other[i]);
+		bbox[i+3] = std::max(bbox[i+3], other[i+3]);
+	}
+}
+
+static bool bbox_disjoint(const double *a, const double *b)
+{
+	for (int i = 0; i < 3; i++)
+		if (a[i+3] + 4*GRID_FINE < b[i] || b[i+3] + 4*GRID_FINE < a[i])
+			return true;
+	return false;
+}
+
+/*!
+	Checks that no two of the boxes overlap by sweeping over them in the
+	order of their lower x bound.
+*/
+static bool bboxes_disjoint(const QVector<const double*> &boxes)
+{
+	std::vector<std::pair<double,int> > order;
+	for (int i = 0; i < boxes.size(); i++)
+		order.push_back(std::make_pair(boxes[i][0], i));
+	std::sort(order.begin(), order.end());
+	for (size_t i = 0; i < order.size(); i++) {
+		const double *a = boxes[order[i].second];
+		for (size_t j = i + 1; j < order.size() && order[j].first <= a[3] + 4*GRID_FINE; j++)
+			if (!bbox_disjoint(a, boxes[order[j].second]))
+				return false;
+	}
+	return true;
+}
+
+static void transform_bbox(const double *m, double *bbox)
+{
+	double in[6];
+	std::copy(bbox, bbox + 6, in);
+	for (int c = 0; c < 8; c++) {
+		double x = in[(c & 1) ? 3 : 0], y = in[(c & 2) ? 4 : 1], z = in[(c & 4) ? 5 : 2];
+		double p[3];
+		for (int i = 0; i < 3; i++)
+			p[i] = (m[i]*x + m[i+4]*y + m[i+8]*z + m[i+12]) / m[15];
+		for (int i = 0; i < 3; i++) {
+			bbox[i] = c == 0 ? p[i] : std::min(bbox[i], p[i]);
+			bbox[i+3] = c == 0 ? p[i] : std::max(bbox[i+3], p[i]);
+		}
+	}
+}
+
+static void multiply_matrix(const double *m, const double *n, double *out)
+{
+	for (int i = 0; i < 16; i++) {
+		out[i] = 0;
+		for (int k = 0; k < 4; k++)
+			out[i] += m[i%4 + k*4] * n[k + (i/4)*4];
+	}
+}
+
+/*!
+	A closed mesh is convex if all of its vertices are on the same side of
+	the plane of each face. This is quadratic, so large meshes are just
+	assumed to be non-convex.
+*/
+static bool polyset_is_convex(const PolySet *ps, double extent)
+{
+	double n = 0;
+	for (int i = 0; i < ps->polygons.size(); i++)
+		n += ps->polygons[i].size();
+	if (ps->is2d || ps->polygons.size() < 4 || ps->polygons.size() * n > 1e6)
+		return false;
+	double eps = GRID_FINE * std::max(1.0, extent);
+	for (int i = 0; i < ps->polygons.size(); i++) {
+		const PolySet::Polygon &poly = ps->polygons[i];
+		double nx = 0, ny = 0, nz = 0;
+		for (int j = 0; j < poly.size(); j++) {
+			const PolySet::Point &a = poly[j], &b = poly[(j+1) % poly.size()];
+			nx += (a.y - b.y) * (a.z + b.z);
+			ny += (a.z - b.z) * (a.x + b.x);
+			nz += (a.x - b.x) * (a.y + b.y);
+		}
+		double len = sqrt(nx*nx + ny*ny + nz*nz);
+		if (len == 0 || poly.isEmpty())
+			continue;
+		const PolySet::Point &o = poly[0];
+		bool above = false, below = false;
+		for (int k = 0; k < ps->polygons.size(); k++) {
+			for (int j = 0; j < ps->polygons[k].size(); j++) {
+				const PolySet::Point &r = ps->polygons[k][j];
+				double d = ((r.x - o.x)*nx + (r.y - o.y)*ny + (r.z - o.z)*nz) / len;
+				above = above || d > eps;
+				below = below || d < -eps;
+			}
+			if (above && below)
+				return false;
+		}
+	}
+	return true;
+}
+
+static void measure_polyset(const PolySet *ps, RenderPlanner::plan_t &p)
+{
+	p.dim = ps->is2d ? 2 : 3;
+	p.facets = ps->polygons.size();
+	p.has_bbox = false;
+	for (int i = 0; i < ps->polygons.size(); i++) {
+		for (int j = 0; j < ps->polygons[i].size(); j++) {
+			const PolySet::Point &v = ps->polygons[i][j];
+			double b[6] = { v.x, v.y, v.z, v.x, v.y, v.z };
+			if (p.has_bbox)
+				merge_bbox(p.bbox, b);
+			else
+				std::copy(b, b + 6, p.bbox);
+			p.has_bbox = true;
+		}
+	}
+	double extent = 0;
+	for (int i = 0; p.has_bbox && i < 3; i++)
+		extent = std::max(extent, p.bbox[i+3] - p.bbox[i]);
+	p.convex = polyset_is_convex(ps, extent);
+	p.bits = input_bits(p);
+}
+
+/*!
+	Measures a Nef polyhedron which is already in the cache, including the
+	size of its exact coordinates.
+*/
+static void measure_nef(const CGAL_Nef_polyhedron &N, RenderPlanner::plan_t &p)
+{
+	p.dim = N.dim;
+	p.has_bbox = false;
+	p.bits = 0;
+	if (N.dim == 2) {
+		typedef CGAL_Nef_polyhedron2::Explorer Explorer;
+		Explorer E = N.p2->explorer();
+		for (Explorer::Vertex_const_iterator v = E.vertices_begin(); v != E.vertices_end(); ++v) {
+			if (!E.is_standard(v))
+				continue;
+			Explorer::Point pt = E.point(v);
+			CGAL::Gmpq c[2] = { pt.x(), pt.y() };
+			double b[6] = { to_double(c[0]), to_double(c[1]), 0, to_double(c[0]), to_double(c[1]), 0 };
+			if (p.has_bbox)
+				merge_bbox(p.bbox, b);
+			else
+				std::copy(b, b + 6, p.bbox);
+			p.has_bbox = true;
+			for (int i = 0; i < 2; i++)
+				p.bits = std::max(p.bits, (double)c[i].numerator().bit_size());
+		}
+		p.facets = E.number_of_edges();
+	}
+	if (N.dim == 3) {
+		CGAL_Nef_polyhedron3::Vertex_const_iterator v;
+		for (v = N.p3->vertices_begin(); v != N.p3->vertices_end(); ++v) {
+			const CGAL_Point &pt = v->point();
+			CGAL::Gmpq c[3] = { pt.x(), pt.y(), pt.z() };
+			double b[6] = { to_double(c[0]), to_double(c[1]), to_double(c[2]),
+					to_double(c[0]), to_double(c[1]), to_double(c[2]) };
+			if (p.has_bbox)
+				merge_bbox(p.bbox, b);
+			else
+				std::copy(b, b + 6, p.bbox);
+			p.has_bbox = true;
+			for (int i = 0; i < 3; i++)
+				p.bits = std::max(p.bits, (double)c[i].numerator().bit_size());
+		}
+		p.facets = N.p3->number_of_facets();
+	}
+}
+
+RenderPlanner::RenderPlanner() : total_cost(0)
+{
+}
+
+RenderPlanner::~RenderPlanner()
+{
+	foreach (const QString &cache_id, kept)
+		delete PolySet::ps_pinned.take(cache_id);
+}
+
+/*!
+	Keeps a PolySet tessellated for planning until the planner goes away,
+	so the render that follows finds it even on models with more
+	primitives than PolySet::ps_cache holds.
+*/
+void RenderPlanner::keep(const QString &cache_id, PolySet *ps)
+{
+	if (PolySet::ps_pinned.contains(cache_id) || !PolySet::ps_cache.contains(cache_id))
+		return;
+	PolySet::ps_cache_entry *e = new PolySet::ps_cache_entry(ps->link());
+	e->msg = PolySet::ps_cache[cache_id]->msg;
+	PolySet::ps_pinned.insert(cache_id, e);
+	kept.append(cache_id);
+}
+
+void RenderPlanner::plan(const AbstractNode *root)
+{
+	plans.clear();
+	planned.clear();
+	total_cost = plan_node(root).cost;
+	assign(root, false);
+}
+
+/*!
+	Folds the operands of a boolean operation into p, in the order CGAL
+	will evaluate them.
+*/
+static void fold_operands(RenderPlanner::plan_t &p, const QVector<RenderPlanner::plan_t> &operands, int type)
+{
+	bool overlapping = false;
+	for (int i = 0; i < operands.size(); i++) {
+		const RenderPlanner::plan_t &c = operands[i];
+		p.cost += c.cost;
+		if (i == 0) {
+			p.dim = c.dim;
+			p.facets = c.facets;
+			p.has_bbox = c.has_bbox;
+			std::copy(c.bbox, c.bbox + 6, p.bbox);
+			p.convex = c.convex;
+			p.bits = c.bits;
+			continue;
+		}
+		if (p.dim == 0)
+			p.dim = c.dim;
+		double op = COST_OP * nlogn(p.facets + c.facets) * bits_factor(std::max(p.bits, c.bits));
+		if (p.convex && c.convex)
+			op *= 0.5;
+		if (p.dim == 2)
+			op *= COST_2D;
+		p.cost += op;
+		overlapping = overlapping || !p.has_bbox || !c.has_bbox || !bbox_disjoint(p.bbox, c.bbox);
+		if (type == CSG_TYPE_INTERSECTION) {
+			p.facets = std::min(p.facets + c.facets, 2 * std::min(p.facets, c.facets));
+			if (p.has_bbox && c.has_bbox) {
+				for (int j = 0; j < 3; j++) {
+					p.bbox[j] = std::max(p.bbox[j], c.bbox[j]);
+					p.bbox[j+3] = std::min(p.bbox[j+3], c.bbox[j+3]);
+				}
+			} else if (c.has_bbox) {
+				p.has_bbox = true;
+				std::copy(c.bbox, c.bbox + 6, p.bbox);
+			}
+			p.convex = p.convex && c.convex;
+		} else {
+			p.facets += c.facets;
+			if (type == CSG_TYPE_UNION) {
+				p.has_bbox = p.has_bbox && c.has_bbox;
+				if (p.has_bbox)
+					merge_bbox(p.bbox, c.bbox);
+			}
+			p.convex = false;
+		}
+		p.bits = std::max(p.bits, c.bits);
+	}
+	// New vertices on intersecting faces need longer numbers, unless they
+	// are snapped back onto the grid
+	if (overlapping)
+		p.bits = AbstractNode::cgal_nef_snap ? input_bits(p) : std::min(4096.0, p.bits * 1.5);
+}
+
+RenderPlanner::plan_t RenderPlanner::plan_node(const AbstractNode *node)
+{
+	plan_t p;
+	p.engine = AbstractNode::ENGINE_NEF;
+	p.dim = 0;
+	p.facets = 0;
+	p.has_bbox = false;
+	std::fill(p.bbox, p.bbox + 6, 0.0);
+	p.convex = false;
+	p.mesh = false;
+	p.bits = 53;
+	p.cost = 0;
+	p.mesh_cost = 0;
+
+	// Results in the cache, or computed earlier in this render, are free
+	QString cache_id = node->mk_cache_id();
+	if (planned.contains(cache_id) || AbstractNode::cgal_nef_cache.contains(cache_id)) {
+		if (planned.contains(cache_id))
+			p = planned[cache_id];
+		else
+			measure_nef(AbstractNode::cgal_nef_cache[cache_id]->N, p);
+		p.engine = AbstractNode::ENGINE_CACHED;
+		p.cost = 0;
+		p.mesh = false;
+		if (!plans.contains(node))
+			plans[node] = p;
+		return p;
+	}
+
+	QVector<plan_t> operands;
+	foreach (AbstractNode::Pointer v, node->children) {
+		if (!v->props.background)
+			operands.append(plan_node(v.get()));
+	}
+
+	const AbstractPolyNode *pn = dynamic_cast<const AbstractPolyNode*>(node);
+	const TransformNode *tn = dynamic_cast<const TransformNode*>(node);
+	if (pn && (operands.isEmpty() || PolySet::ps_cache.contains(cache_id) || PolySet::ps_pinned.contains(cache_id)))
+	{
+		// Primitives without a PolySet, e.g. unreadable files, cost nothing
+		if (PolySet *ps = pn->render_cached_polyset()) {
+			keep(cache_id, ps);
+			measure_polyset(ps, p);
+			ps->unlink();
+			p.cost = COST_BUILD * nlogn(p.facets) * (p.dim == 2 ? COST_2D : 1);
+			p.mesh = p.dim == 3;
+			p.mesh_cost = COST_MESH * p.facets;
+		}
+	}
+	else if (pn)
+	{
+		// Extrusions and the like, don't render them just for planning
+		for (int i = 0; i < operands.size(); i++) {
+			p.cost += operands[i].cost;
+			p.facets += operands[i].facets * 4;
+		}
+		p.cost += COST_BUILD * nlogn(p.facets);
+	}
+	else if (tn)
+	{
+		fold_operands(p, operands, CSG_TYPE_UNION);
+		double m[16];
+		for (int i = 0; i < 16; i++)
+			m[i] = tn->m[i];
+		if (p.has_bbox)
+			transform_bbox(m, p.bbox);
+		bool has_rational = tn->rational_q[0] != 0 || tn->rational_q[1] != 0 ||
+				tn->rational_q[2] != 0 || tn->rational_q[3] != 0;
+		p.mesh = p.dim == 3 && tn->is_affine() && !operands.isEmpty();
+		for (int i = 0; i < operands.size(); i++) {
+			p.mesh = p.mesh && operands[i].mesh;
+			p.mesh_cost += operands[i].mesh_cost;
+		}
+		bool axis_aligned = true;
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				axis_aligned = axis_aligned && (m[i+j*4] == 0 || fabs(m[i+j*4]) == 1);
+		if (!axis_aligned)
+			p.bits += has_rational ? 24 : input_bits(p);
+		// Chains of transformations over meshes are applied to the vertices
+		if (!p.mesh)
+			p.cost += COST_TRANSFORM * p.facets * bits_factor(p.bits);
+	}
+	else if (dynamic_cast<const CgaladvMinkowskiNode*>(node))
+	{
+		double facets = 1;
+		for (int i = 0; i < operands.size(); i++) {
+			p.cost += operands[i].cost;
+			facets *= std::max(1.0, operands[i].facets);
+			p.dim = std::max(p.dim, operands[i].dim);
+			p.bits = std::max(p.bits, operands[i].bits);
+			p.has_bbox = i == 0 ? operands[i].has_bbox : p.has_bbox && operands[i].has_bbox;
+			for (int j = 0; j < 6 && p.has_bbox; j++)
+				p.bbox[j] = i == 0 ? operands[i].bbox[j] : p.bbox[j] + operands[i].bbox[j];
+		}
+		p.facets = facets;
+		p.cost += COST_OP * nlogn(facets) * bits_factor(p.bits);
+	}
+	else if (dynamic_cast<const CgaladvHullNode*>(node))
+	{
+		fold_operands(p, operands, CSG_TYPE_UNION);
+		p.convex = true;
+	}
+	else if (is_intersection(node))
+	{
+		fold_operands(p, operands, CSG_TYPE_INTERSECTION);
+		bool known = operands.size() > 1;
+		for (int i = 0; i < operands.size(); i++)
+			known = known && operands[i].dim == 3 && operands[i].has_bbox;
+		bool empty = false;
+		for (int i = 0; known && i < 3; i++)
+			empty = empty || p.bbox[i] > p.bbox[i+3] + 4*GRID_FINE;
+		if (empty) {
+			p.engine = AbstractNode::ENGINE_EMPTY;
+			p.cost = 0;
+			p.facets = 0;
+			p.convex = true;
+		}
+	}
+	else if (is_difference(node))
+	{
+		fold_operands(p, operands, CSG_TYPE_DIFFERENCE);
+	}
+	else if (is_union(node))
+	{
+		fold_operands(p, operands, CSG_TYPE_UNION);
+
+		// Disjoint meshes don't need a boolean operation at all
+		QVector<const double*> boxes;
+		bool disjoint = p.dim == 3;
+		double concat_cost = 0;
+		for (int i = 0; i < operands.size(); i++) {
+			disjoint = disjoint && operands[i].mesh && operands[i].has_bbox;
+			boxes.append(operands[i].bbox);
+			concat_cost += operands[i].mesh_cost;
+		}
+		disjoint = disjoint && !operands.isEmpty() && bboxes_disjoint(boxes);
+		if (disjoint) {
+			p.mesh = true;
+			p.mesh_cost = concat_cost;
+			p.bits = input_bits(p);
+			concat_cost += COST_BUILD * nlogn(p.facets);
+			if (operands.size() > 1 && concat_cost < p.cost) {
+				p.engine = AbstractNode::ENGINE_CONCAT;
+				p.cost = concat_cost;
+			}
+		}
+	}
+	else
+	{
+		fold_operands(p, operands, CSG_TYPE_UNION);
+		p.has_bbox = false;
+		p.convex = false;
+	}
+
+	planned[cache_id] = p;
+	plans[node] = p;
+	return p;
+}
+
+void RenderPlanner::assign(const AbstractNode *node, bool as_mesh)
+{
+	if (!plans.contains(node))
+		return;
+	const plan_t p = plans[node];
+	AbstractNode *n = const_cast<AbstractNode*>(node);
+	n->render_engine = as_mesh ? AbstractNode::ENGINE_MESH : p.engine;
+	if (p.engine == AbstractNode::ENGINE_CACHED || p.engine == AbstractNode::ENGINE_EMPTY)
+		return;
+	foreach (AbstractNode::Pointer v, node->children) {
+		if (!v->props.background)
+			assign(v.get(), as_mesh || p.engine == AbstractNode::ENGINE_CONCAT);
+	}
+}
+
+static QString format_msecs(double msecs)
+{
+	if (msecs < 1000)
+		return QString("%1 ms").arg((int)msecs);
+	if (msecs < 120000)
+		return QString("%1 s").arg(msecs / 1000, 0, 'f', 1);
+	return QString("%1 minutes").arg((int)(msecs / 60000));
+}
+
+int RenderPlanner::predicted_msecs() const
+{
+	return (int)(total_cost * msecs_per_unit);
+}
+
+/*!
+	Feeds the measured time of the render which was planned last back
+	into the cost model. Renders which were mostly cached tell nothing.
+*/
+void RenderPlanner::calibrate(int msecs) const
+{
+	if (total_cost < 1000 || msecs <= 0)
+		return;
+	msecs_per_unit = (msecs_per_unit + msecs / total_cost) / 2;
+}
+
+void RenderPlanner::print_report() const
+{
+	int counts[5] = { 0, 0, 0, 0, 0 };
+	QHashIterator<const AbstractNode*, plan_t> i(plans);
+	while (i.hasNext()) {
+		i.next();
+		counts[i.key()->render_engine]++;
+	}
+	PRINTF("Render planner: %d nodes, %d cached, %d concatenated unions, %d empty intersections, predicted render time %s.",
+			plans.size(), counts[AbstractNode::ENGINE_CACHED], counts[AbstractNode::ENGINE_CONCAT],
+			counts[AbstractNode::ENGINE_EMPTY], format_msecs(predicted_msecs()).toAscii().data());
+}
+
+void RenderPlanner::print_plan(const AbstractNode *root) const
+{
+	PRINT_NOCACHE("Render plan:");
+	print_node(root, "  ");
+}
+
+void RenderPlanner::print_node(const AbstractNode *node, QString indent) const
+{
+	if (!plans.contains(node))
+		return;
+	const plan_t &p = plans[node];
+	QString label = node->dump_label();
+	double cost = node->render_engine == AbstractNode::ENGINE_MESH ? p.mesh_cost : p.cost;
+	QString text;
+	text.sprintf(" [%s] cost %.0f (%s), %dD, %.0f facets, %.0f bits",
+			engine_names[node->render_engine], cost,
+			format_msecs(cost * msecs_per_unit).toAscii().data(), p.dim, p.facets, p.bits);
+	if (p.convex)
+		text += ", convex";
+	if (p.has_bbox && node->render_engine != AbstractNode::ENGINE_EMPTY) {
+		QString bbox;
+		bbox.sprintf(", bbox [%g %g %g] - [%g %g %g]", p.bbox[0], p.bbox[1], p.bbox[2], p.bbox[3], p.bbox[4], p.bbox[5]);
+		text += bbox;
+	}
+	PRINT_NOCACHE(indent + label + text);
+	if (node->render_engine == AbstractNode::ENGINE_CACHED || node->render_engine == AbstractNode::ENGINE_EMPTY)
+		return;
+	foreach (AbstractNode::Pointer v, node->children) {
+		if (!v->props.background)
+			print_node(v.get(), indent + "  ");
+	}
+}
+
+/*!
+	Appends the triangles of a mesh-only subtree to ps, moving the
+	vertices by the accumulated matrix m.
+*/
+static bool append_mesh(PolySet *ps, const AbstractNode *node, const double *m)
+{
+	if (const TransformNode *tn = dynamic_cast<const TransformNode*>(node)) {
+		// Projective matrices and exact rotations need the Nef path
+		if (!tn->is_affine())
+			return false;
+		double tm[16], mt[16];
+		for (int i = 0; i < 16; i++)
+			tm[i] = tn->m[i];
+		multiply_matrix(m, tm, mt);
+		foreach (AbstractNode::Pointer v, node->children) {
+			if (!v->props.background && !append_mesh(ps, v.get(), mt))
+				return false;
+		}
+	} else if (const AbstractPolyNode *pn = dynamic_cast<const AbstractPolyNode*>(node)) {
+		PolySet *src = pn->render_cached_polyset();
+		if (!src)
+			return false;
+		if (src->is2d) {
+			src->unlink();
+			return false;
+		}
+		double det = m[0]*(m[5]*m[10] - m[9]*m[6]) - m[4]*(m[1]*m[10] - m[9]*m[2]) + m[8]*(m[1]*m[6] - m[5]*m[2]);
+		for (int j = 0; j < src->polygons.size(); j++) {
+			const PolySet::Polygon &poly = src->polygons[j];
+			ps->append_poly();
+			for (int k = 0; k < poly.size(); k++) {
+				// Mirroring turns the faces inside out unless the order is reversed
+				const PolySet::Point &p = poly[det < 0 ? poly.size() - 1 - k : k];
+				ps->append_vertex(m[0]*p.x + m[4]*p.y + m[ 8]*p.z + m[12],
+						m[1]*p.x + m[5]*p.y + m[ 9]*p.z + m[13],
+						m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14]);
+			}
+		}
+		src->unlink();
+	} else {
+		foreach (AbstractNode::Pointer v, node->children) {
+			if (!v->props.background && !append_mesh(ps, v.get(), m))
+				return false;
+		}
+	}
+	node->progress_report();
+	return true;
+}
+
+/*!
+	Renders a union of disjoint meshes by building one Nef polyhedron from
+	all of their triangles. Returns false if that doesn't work out, the
+	caller then falls back to the usual boolean operations.
+*/
+bool RenderPlanner::render_concat(const AbstractNode *node, CGAL_Nef_polyhedron &N)
+{
+	static const double identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	PolySet *ps = new PolySet();
+	bool ok;
+
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	try {
+		ok = append_mesh(ps, node, identity);
+		if (ok)
+			N = ps->render_cgal_nef_polyhedron();
+	}
+	catch (CGAL::Failure_exception e) {
+		ok = false;
+	}
+	catch (...) { // Don't leak the PolySet on ProgressCancelException
+		CGAL::set_error_behaviour(old_behaviour);
+		ps->unlink();
+		throw;
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+	ps->unlink();
+
+	if (!ok || N.dim != 3 || !N.p3->is_simple()) {
+		PRINT("WARNING: Can't build disjoint union as one mesh, falling back to boolean operations.");
+		N = CGAL_Nef_polyhedron();
+		return false;
+	}
+	return true;
+}
+
+#endif /* ENABLE_CGAL */
@@ -0,0 +1,95 @@
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifdef ENABLE_CGAL
+
+#include "node.h"
+#include <QHash>
+
+/*!
+	Estimates the cost of rendering each node of a tree with CGAL from
+	facet counts, bounding boxes, convexity and the expected size of the
+	exact numbers, and picks the cheapest engine per node:
+
+	- cached: the result is already in the Nef cache
+	- concat: a union of disjoint 3D meshes is built as one polyhedron
+	- mesh:   the node is only needed as a mesh by a concat parent
+	- empty:  an intersection of disjoint objects, nothing to compute
+	- nef:    everything else goes through Nef polyhedra
+
+	The choice is stored in AbstractNode::render_engine. The plan can be
+	printed like an EXPLAIN of a database query, together with a render
+	time prediction which is calibrated by the previous renders.
+*/
+class RenderPlanner
+{
+public:
+	static bool enabled;
+	static bool explain;
+
+	RenderPlanner();
+	~RenderPlanner();
+	void plan(const AbstractNode *root);
+	void print_plan(const AbstractNode *root) const;
+	void print_report() const;
+	int predicted_msecs() const;
+	void calibrate(int msecs) const;
+
+	static bool render_concat(const AbstractNode *node, CGAL_Nef_polyhedron &N);
+
+	struct plan_t {
+		AbstractNode::render_engine_e engine;
+		int dim;
+		double facets;
+		bool has_bbox;
+		double bbox[6];
+		bool convex;
+		bool mesh;
+		double bits;
+		double cost;
+		double mesh_cost;
+	};
+
+private:
+	plan_t plan_node(const AbstractNode *node);
+	void assign(const AbstractNode *node, bool as_mesh);
+	void print_node(const AbstractNode *node, QString indent) const;
+	void keep(const QString &cache_id, PolySet *ps);
+
+	QHash<const AbstractNode*, plan_t> plans;
+	QHash<QString, plan_t> planned;
+	QList<QString> kept;
+	double total_cost;
+
+	static double msecs_per_unit;
+};
+
+#endif /* ENABLE_CGAL */
+
+#endif
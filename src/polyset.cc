@@ -31,10 +31,10 @@
 #include <CGAL/assertions_behaviour.h>
 #include <CGAL/exceptions.h>
 #endif
-#include <Eigen/Core>
-#include <Eigen/LU>
+#include <stdlib.h>
 
 QCache<QString,PolySet::ps_cache_entry> PolySet::ps_cache(100);
+QHash<QString,PolySet::ps_cache_entry*> PolySet::ps_pinned;
 
 PolySet::ps_cache_entry::ps_cache_entry(PolySet *ps) :
 		ps(ps), msg(print_messages_stack.last()) { }
@@ -43,7 +43,7 @@ PolySet::ps_cache_entry::~ps_cache_entry() {
 	ps->unlink();
 }
 
-PolySet::PolySet() : grid(GRID_FINE)
+PolySet::PolySet() : polygons(this), borders(this), grid(GRID_FINE)
 {
 	is2d = false;
 	convexity = 1;
@@ -67,28 +67,77 @@ void PolySet::unlink()
 		delete this;
 }
 
+/*!
+	Returns the index of the vertex at x, y, z aligned to the grid, adding
+	it if no vertex is close enough yet.
+*/
+int PolySet::add_vertex(double x, double y, double z)
+{
+	int &v = grid.align(x, y, z);
+	if (v == 0) {
+		add_vertex(Point(x, y, z));
+		v = vx.size();
+	}
+	return v - 1;
+}
+
+/*!
+	Adds a vertex as it is, without looking for an existing one.
+*/
+int PolySet::add_vertex(const Point &p)
+{
+	vx.append(p.x);
+	vy.append(p.y);
+	vz.append(p.z);
+	return vx.size() - 1;
+}
+
 void PolySet::append_poly()
 {
-	polygons.append(Polygon());
+	polygons.append_poly();
 }
 
 void PolySet::append_vertex(double x, double y, double z)
 {
-	grid.align(x, y, z);
-	polygons.last().append(Point(x, y, z));
+	polygons.append_index(add_vertex(x, y, z));
 }
 
 void PolySet::insert_vertex(double x, double y, double z)
 {
-	grid.align(x, y, z);
-	polygons.last().insert(0, Point(x, y, z));
+	polygons.insert_index(add_vertex(x, y, z));
+}
+
+/*!
+	Appends a triangle of vertices added with add_vertex().
+*/
+void PolySet::append_triangle(int v0, int v1, int v2)
+{
+	polygons.append_poly();
+	polygons.append_index(v0);
+	polygons.append_index(v1);
+	polygons.append_index(v2);
+}
+
+void PolySet::append_border()
+{
+	borders.append_poly();
+}
+
+void PolySet::append_border_vertex(double x, double y, double z)
+{
+	borders.append_index(add_vertex(x, y, z));
 }
 
-static void gl_draw_triangle(GLint *shaderinfo, const PolySet::Point *p0, const PolySet::Point *p1, const PolySet::Point *p2, bool e0, bool e1, bool e2, double z, bool mirrored)
+void PolySet::insert_border_vertex(double x, double y, double z)
 {
-	double ax = p1->x - p0->x, bx = p1->x - p2->x;
-	double ay = p1->y - p0->y, by = p1->y - p2->y;
-	double az = p1->z - p0->z, bz = p1->z - p2->z;
+	borders.insert_index(add_vertex(x, y, z));
+}
+
+static void gl_draw_triangle(GLint *shaderinfo, const PolySet::Point &p0, const PolySet::Point &p1, const PolySet::Point &p2, bool e0, bool e1, bool e2, double z, bool mirrored)
+{
+	double ax = p1.x - p0.x, bx = p1.x - p2.x;
+	double ay = p1.y - p0.y, by = p1.y - p2.y;
+	double az = p1.z - p0.z, bz = p1.z - p2.z;
 	double nx = ay*bz - az*by;
 	double ny = az*bx - ax*bz;
 	double nz = ax*by - ay*bx;
@@ -100,50 +149,44 @@ static void gl_draw_triangle(GLint *shaderinfo, const PolySet::Point *p0, const
 		double e1f = e1 ? 2.0 : -1.0;
 		double e2f = e2 ? 2.0 : -1.0;
 		glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-		glVertexAttrib3d(shaderinfo[4], p1->x, p1->y, p1->z + z);
-		glVertexAttrib3d(shaderinfo[5], p2->x, p2->y, p2->z + z);
+		glVertexAttrib3d(shaderinfo[4], p1.x, p1.y, p1.z + z);
+		glVertexAttrib3d(shaderinfo[5], p2.x, p2.y, p2.z + z);
 		glVertexAttrib3d(shaderinfo[6], 0.0, 1.0, 0.0);
-		glVertex3d(p0->x, p0->y, p0->z + z);
+		glVertex3d(p0.x, p0.y, p0.z + z);
 		if (!mirrored) {
 			glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-			glVertexAttrib3d(shaderinfo[4], p0->x, p0->y, p0->z + z);
-			glVertexAttrib3d(shaderinfo[5], p2->x, p2->y, p2->z + z);
+			glVertexAttrib3d(shaderinfo[4], p0.x, p0.y, p0.z + z);
+			glVertexAttrib3d(shaderinfo[5], p2.x, p2.y, p2.z + z);
 			glVertexAttrib3d(shaderinfo[6], 0.0, 0.0, 1.0);
-			glVertex3d(p1->x, p1->y, p1->z + z);
+			glVertex3d(p1.x, p1.y, p1.z + z);
 		}
 		glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-		glVertexAttrib3d(shaderinfo[4], p0->x, p0->y, p0->z + z);
-		glVertexAttrib3d(shaderinfo[5], p1->x, p1->y, p1->z + z);
+		glVertexAttrib3d(shaderinfo[4], p0.x, p0.y, p0.z + z);
+		glVertexAttrib3d(shaderinfo[5], p1.x, p1.y, p1.z + z);
 		glVertexAttrib3d(shaderinfo[6], 1.0, 0.0, 0.0);
-		glVertex3d(p2->x, p2->y, p2->z + z);
+		glVertex3d(p2.x, p2.y, p2.z + z);
 		if (mirrored) {
 			glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-			glVertexAttrib3d(shaderinfo[4], p0->x, p0->y, p0->z + z);
-			glVertexAttrib3d(shaderinfo[5], p2->x, p2->y, p2->z + z);
+			glVertexAttrib3d(shaderinfo[4], p0.x, p0.y, p0.z + z);
+			glVertexAttrib3d(shaderinfo[5], p2.x, p2.y, p2.z + z);
 			glVertexAttrib3d(shaderinfo[6], 0.0, 0.0, 1.0);
-			glVertex3d(p1->x, p1->y, p1->z + z);
+			glVertex3d(p1.x, p1.y, p1.z + z);
 		}
 	}
 	else
 #endif
 	{
-		glVertex3d(p0->x, p0->y, p0->z + z);
+		glVertex3d(p0.x, p0.y, p0.z + z);
 		if (!mirrored)
-			glVertex3d(p1->x, p1->y, p1->z + z);
-		glVertex3d(p2->x, p2->y, p2->z + z);
+			glVertex3d(p1.x, p1.y, p1.z + z);
+		glVertex3d(p2.x, p2.y, p2.z + z);
 		if (mirrored)
-			glVertex3d(p1->x, p1->y, p1->z + z);
+			glVertex3d(p1.x, p1.y, p1.z + z);
 	}
 }
 
-void PolySet::render_surface(colormode_e colormode, csgmode_e csgmode, const Float20 &m, GLint *shaderinfo) const
+void PolySet::render_surface(colormode_e colormode, csgmode_e csgmode, bool mirrored, GLint *shaderinfo) const
 {
-	Eigen::Matrix3f m3f;
-	m3f << m[0], m[4], m[8],
-		m[1], m[5], m[9],
-		m[2], m[6], m[10];
-	bool mirrored = m3f.determinant() < 0;
-
 	if (colormode == COLORMODE_MATERIAL) {
 		const QColor &col = Preferences::inst()->color(Preferences::OPENCSG_FACE_FRONT_COLOR);
 		glColor3f(col.redF(), col.greenF(), col.blueF());
@@ -194,81 +237,81 @@ void PolySet::render_surface(colormode_e colormode, csgmode_e csgmode, const Flo
 		for (double z = -zbase/2; z < zbase; z += zbase)
 		{
 			for (int i = 0; i < polygons.size(); i++) {
-				const Polygon *poly = &polygons[i];
-				if (poly->size() == 3) {
+				Polygon poly = polygons[i];
+				if (poly.size() == 3) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, &poly->at(0), &poly->at(2), &poly->at(1), true, true, true, z, mirrored);
+						gl_draw_triangle(shaderinfo, poly[0], poly[2], poly[1], true, true, true, z, mirrored);
 					} else {
-						gl_draw_triangle(shaderinfo, &poly->at(0), &poly->at(1), &poly->at(2), true, true, true, z, mirrored);
+						gl_draw_triangle(shaderinfo, poly[0], poly[1], poly[2], true, true, true, z, mirrored);
 					}
 				}
-				else if (poly->size() == 4) {
+				else if (poly.size() == 4) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, &poly->at(0), &poly->at(3), &poly->at(1), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, &poly->at(2), &poly->at(1), &poly->at(3), true, false, true, z, mirrored);
+						gl_draw_triangle(shaderinfo, poly[0], poly[3], poly[1], true, false, true, z, mirrored);
+						gl_draw_triangle(shaderinfo, poly[2], poly[1], poly[3], true, false, true, z, mirrored);
 					} else {
-						gl_draw_triangle(shaderinfo, &poly->at(0), &poly->at(1), &poly->at(3), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, &poly->at(2), &poly->at(3), &poly->at(1), true, false, true, z, mirrored);
+						gl_draw_triangle(shaderinfo, poly[0], poly[1], poly[3], true, false, true, z, mirrored);
+						gl_draw_triangle(shaderinfo, poly[2], poly[3], poly[1], true, false, true, z, mirrored);
 					}
 				}
 				else {
 					Point center;
-					for (int j = 0; j < poly->size(); j++) {
-						center.x += poly->at(j).x;
-						center.y += poly->at(j).y;
+					for (int j = 0; j < poly.size(); j++) {
+						center.x += vx[poly.index(j)];
+						center.y += vy[poly.index(j)];
 					}
-					center.x /= poly->size();
-					center.y /= poly->size();
-					for (int j = 1; j <= poly->size(); j++) {
+					center.x /= poly.size();
+					center.y /= poly.size();
+					for (int j = 1; j <= poly.size(); j++) {
 						if (z < 0) {
-							gl_draw_triangle(shaderinfo, &center, &poly->at(j % poly->size()), &poly->at(j - 1),
+							gl_draw_triangle(shaderinfo, center, poly[j % poly.size()], poly[j - 1],
 									false, true, false, z, mirrored);
 						} else {
-							gl_draw_triangle(shaderinfo, &center, &poly->at(j - 1), &poly->at(j % poly->size()),
+							gl_draw_triangle(shaderinfo, center, poly[j - 1], poly[j % poly.size()],
 									false, true, false, z, mirrored);
 						}
 					}
 				}
 			}
 		}
-		const QVector<Polygon> *borders_p = &borders;
+		const PolygonList *borders_p = &borders;
 		if (borders_p->size() == 0)
 			borders_p = &polygons;
 		for (int i = 0; i < borders_p->size(); i++) {
-			const Polygon *poly = &borders_p->at(i);
-			for (int j = 1; j <= poly->size(); j++) {
-				Point p1 = poly->at(j - 1), p2 = poly->at(j - 1);
-				Point p3 = poly->at(j % poly->size()), p4 = poly->at(j % poly->size());
+			Polygon poly = borders_p->at(i);
+			for (int j = 1; j <= poly.size(); j++) {
+				Point p1 = poly[j - 1], p2 = poly[j - 1];
+				Point p3 = poly[j % poly.size()], p4 = poly[j % poly.size()];
 				p1.z -= zbase/2, p2.z += zbase/2;
 				p3.z -= zbase/2, p4.z += zbase/2;
-				gl_draw_triangle(shaderinfo, &p2, &p1, &p3, true, true, false, 0, mirrored);
-				gl_draw_triangle(shaderinfo, &p2, &p3, &p4, false, true, true, 0, mirrored);
+				gl_draw_triangle(shaderinfo, p2, p1, p3, true, true, false, 0, mirrored);
+				gl_draw_triangle(shaderinfo, p2, p3, p4, false, true, true, 0, mirrored);
 			}
 		}
 		glEnd();
 	} else {
 		for (int i = 0; i < polygons.size(); i++) {
-			const Polygon *poly = &polygons[i];
+			Polygon poly = polygons[i];
 			glBegin(GL_TRIANGLES);
-			if (poly->size() == 3) {
-				gl_draw_triangle(shaderinfo, &poly->at(0), &poly->at(1), &poly->at(2), true, true, true, 0, mirrored);
+			if (poly.size() == 3) {
+				gl_draw_triangle(shaderinfo, poly[0], poly[1], poly[2], true, true, true, 0, mirrored);
 			}
-			else if (poly->size() == 4) {
-				gl_draw_triangle(shaderinfo, &poly->at(0), &poly->at(1), &poly->at(3), true, false, true, 0, mirrored);
-				gl_draw_triangle(shaderinfo, &poly->at(2), &poly->at(3), &poly->at(1), true, false, true, 0, mirrored);
+			else if (poly.size() == 4) {
+				gl_draw_triangle(shaderinfo, poly[0], poly[1], poly[3], true, false, true, 0, mirrored);
+				gl_draw_triangle(shaderinfo, poly[2], poly[3], poly[1], true, false, true, 0, mirrored);
 			}
 			else {
 				Point center;
-				for (int j = 0; j < poly->size(); j++) {
-					center.x += poly->at(j).x;
-					center.y += poly->at(j).y;
-					center.z += poly->at(j).z;
+				for (int j = 0; j < poly.size(); j++) {
+					center.x += vx[poly.index(j)];
+					center.y += vy[poly.index(j)];
+					center.z += vz[poly.index(j)];
 				}
-				center.x /= poly->size();
-				center.y /= poly->size();
-				center.z /= poly->size();
-				for (int j = 1; j <= poly->size(); j++) {
-					gl_draw_triangle(shaderinfo, &center, &poly->at(j - 1), &poly->at(j % poly->size()), false, true, false, 0, mirrored);
+				center.x /= poly.size();
+				center.y /= poly.size();
+				center.z /= poly.size();
+				for (int j = 1; j <= poly.size(); j++) {
+					gl_draw_triangle(shaderinfo, center, poly[j - 1], poly[j % poly.size()], false, true, false, 0, mirrored);
 				}
 			}
 			glEnd();
@@ -291,32 +334,32 @@ void PolySet::render_edges(colormode_e colormode, csgmode_e csgmode) const
 		for (double z = -zbase/2; z < zbase; z += zbase)
 		{
 			for (int i = 0; i < borders.size(); i++) {
-				const Polygon *poly = &borders[i];
+				Polygon poly = borders[i];
 				glBegin(GL_LINE_LOOP);
-				for (int j = 0; j < poly->size(); j++) {
-					const Point *p = &poly->at(j);
-					glVertex3d(p->x, p->y, z);
+				for (int j = 0; j < poly.size(); j++) {
+					int v = poly.index(j);
+					glVertex3d(vx[v], vy[v], z);
 				}
 				glEnd();
 			}
 		}
 		for (int i = 0; i < borders.size(); i++) {
-			const Polygon *poly = &borders[i];
+			Polygon poly = borders[i];
 			glBegin(GL_LINES);
-			for (int j = 0; j < poly->size(); j++) {
-				const Point *p = &poly->at(j);
-				glVertex3d(p->x, p->y, -zbase/2);
-				glVertex3d(p->x, p->y, +zbase/2);
+			for (int j = 0; j < poly.size(); j++) {
+				int v = poly.index(j);
+				glVertex3d(vx[v], vy[v], -zbase/2);
+				glVertex3d(vx[v], vy[v], +zbase/2);
 			}
 			glEnd();
 		}
 	} else {
 		for (int i = 0; i < polygons.size(); i++) {
-			const Polygon *poly = &polygons[i];
+			Polygon poly = polygons[i];
 			glBegin(GL_LINE_LOOP);
-			for (int j = 0; j < poly->size(); j++) {
-				const Point *p = &poly->at(j);
-				glVertex3d(p->x, p->y, p->z);
+			for (int j = 0; j < poly.size(); j++) {
+				int v = poly.index(j);
+				glVertex3d(vx[v], vy[v], vz[v]);
 			}
 			glEnd();
 		}
@@ -327,6 +370,51 @@ void PolySet::render_edges(colormode_e colormode, csgmode_e csgmode) const
 
 #undef GEN_SURFACE_DEBUG
 
+double cgal_quantize_grid = 0;
+CGAL::Gmpq cgal_quantize_step = 0;
+
+/*!
+	Sets the quantization grid from its decimal notation, e.g. "0.0003" or
+	"3e-4". Returns false if text isn't a non-negative decimal number.
+*/
+bool cgal_set_quantize_grid(const std::string &text)
+{
+	CGAL::Gmpz num(0), den(1);
+	bool digits = false, point = false;
+	size_t i;
+	for (i = 0; i < text.size(); i++) {
+		char c = text[i];
+		if (c >= '0' && c <= '9') {
+			num = num * CGAL::Gmpz(10) + CGAL::Gmpz(c - '0');
+			if (point)
+				den = den * CGAL::Gmpz(10);
+			digits = true;
+		} else if (c == '.' && !point) {
+			point = true;
+		} else {
+			break;
+		}
+	}
+	if (!digits)
+		return false;
+	if (i < text.size()) {
+		if (text[i] != 'e' && text[i] != 'E')
+			return false;
+		const char *start = text.c_str() + i + 1;
+		char *end;
+		long e = strtol(start, &end, 10);
+		if (end == start || *end || e > 100 || e < -100)
+			return false;
+		for (; e > 0; e--)
+			num = num * CGAL::Gmpz(10);
+		for (; e < 0; e++)
+			den = den * CGAL::Gmpz(10);
+	}
+	cgal_quantize_grid = strtod(text.c_str(), NULL);
+	cgal_quantize_step = CGAL::Gmpq(num, den);
+	return true;
+}
+
 class CGAL_Build_PolySet : public CGAL::Modifier_base<CGAL_HDS>
 {
 public:
@@ -339,18 +427,24 @@ public:
 	{
 		CGAL_Polybuilder B(hds, true);
 
-		QList<PolySet::Point> vertices;
-		Grid3d<int> vertices_idx(GRID_FINE);
-
-		for (int i = 0; i < ps->polygons.size(); i++) {
-			const PolySet::Polygon *poly = &ps->polygons[i];
-			for (int j = 0; j < poly->size(); j++) {
-				const PolySet::Point *p = &poly->at(j);
-				if (!vertices_idx.has(p->x, p->y, p->z)) {
-					vertices_idx.data(p->x, p->y, p->z) = vertices.size();
-					vertices.append(*p);
-				}
+		// Vertices of the PolySet that are used by its polygons, merged once
+		// per vertex rather than once per polygon corner
+		QVector<PolySet::Point> vertices;
+		QVector<int> vertices_idx(ps->vertex_count(), -1);
+		Grid3d<int> vertices_grid(GRID_FINE);  // index + 1 by grid position
+
+		const QVector<int> &indices = ps->polygons.indices;
+		for (int i = 0; i < indices.size(); i++) {
+			int v = indices[i];
+			if (vertices_idx[v] >= 0)
+				continue;
+			PolySet::Point p = ps->vertex(v);
+			int &n = vertices_grid.align(p.x, p.y, p.z);
+			if (n == 0) {
+				vertices.append(ps->vertex(v));
+				n = vertices.size();
 			}
+			vertices_idx[v] = n - 1;
 		}
 
 		B.begin_surface(vertices.size(), ps->polygons.size());
@@ -360,19 +454,18 @@ public:
 
 		for (int i = 0; i < vertices.size(); i++) {
 			const PolySet::Point *p = &vertices[i];
-			B.add_vertex(Point(p->x, p->y, p->z));
+			B.add_vertex(Point(cgal_quantize(p->x), cgal_quantize(p->y), cgal_quantize(p->z)));
 #ifdef GEN_SURFACE_DEBUG
 			printf("%d: %f %f %f\n", i, p->x, p->y, p->z);
 #endif
 		}
 
 		for (int i = 0; i < ps->polygons.size(); i++) {
-			const PolySet::Polygon *poly = &ps->polygons[i];
+			PolySet::Polygon poly = ps->polygons[i];
 			QHash<int,int> fc;
 			bool facet_is_degenerated = false;
-			for (int j = 0; j < poly->size(); j++) {
-				const PolySet::Point *p = &poly->at(j);
-				int v = vertices_idx.data(p->x, p->y, p->z);
+			for (int j = 0; j < poly.size(); j++) {
+				int v = vertices_idx[poly.index(j)];
 				if (fc[v]++ > 0)
 					facet_is_degenerated = true;
 			}
@@ -382,13 +475,13 @@ public:
 #ifdef GEN_SURFACE_DEBUG
 			printf("F:");
 #endif
-			for (int j = 0; j < poly->size(); j++) {
-				const PolySet::Point *p = &poly->at(j);
+			for (int j = 0; j < poly.size(); j++) {
+				int v = vertices_idx[poly.index(j)];
 #ifdef GEN_SURFACE_DEBUG
-				printf(" %d (%f,%f,%f)", vertices_idx.data(p->x, p->y, p->z), p->x, p->y, p->z);
+				printf(" %d (%f,%f,%f)", v, vertices[v].x, vertices[v].y, vertices[v].z);
 #endif
 				if (!facet_is_degenerated)
-					B.add_vertex_to_facet(vertices_idx.data(p->x, p->y, p->z));
+					B.add_vertex_to_facet(v);
 			}
 #ifdef GEN_SURFACE_DEBUG
 			if (facet_is_degenerated)
@@ -517,14 +610,12 @@ CGAL_Nef_polyhedron PolySet::render_cgal_nef_polyhedron() const
 					for (int j = 0; j < ps->polygons[i].size(); j++) {
 						double x = ps->polygons[i][j].x;
 						double y = ps->polygons[i][j].y;
-						if (this->grid.has(x, y)) {
-							this->polygons[this->poly_n].append(this->grid.data(x, y));
-						} else {
-							this->grid.align(x, y) = point_n;
-							this->polygons[this->poly_n].append(point_n);
-							this->points[point_n] = CGAL_Nef_polyhedron2::Point(x, y);
-							point_n++;
+						int &p = this->grid.align(x, y);
+						if (p == 0) {
+							p = point_n++;
+							this->points[p] = CGAL_Nef_polyhedron2::Point(cgal_quantize(x), cgal_quantize(y));
 						}
+						this->polygons[this->poly_n].append(p);
 					}
 					add_edges(this->poly_n);
 					this->poly_n++;
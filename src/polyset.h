@@ -16,6 +16,7 @@
 #endif
 
 #include <QCache>
+#include <QHash>
 #include "matrix.h"
 
 class PolySet
@@ -26,10 +27,57 @@ public:
 		Point() : x(0), y(0), z(0) { }
 		Point(double x, double y, double z) : x(x), y(y), z(z) { }
 	};
-	typedef QList<Point> Polygon;
-	QVector<Polygon> polygons;
-	QVector<Polygon> borders;
-	Grid3d<void*> grid;
+
+	/*!
+		One polygon of a PolygonList: a view into its index buffer, valid
+		until the PolySet is modified.
+	*/
+	class Polygon
+	{
+	public:
+		Polygon(const PolySet *ps, const int *idx, int n) : ps(ps), idx(idx), n(n) { }
+		int size() const { return n; }
+		bool isEmpty() const { return n == 0; }
+		int index(int j) const { return idx[j]; }
+		Point at(int j) const { return ps->vertex(idx[j]); }
+		Point operator[](int j) const { return ps->vertex(idx[j]); }
+	private:
+		const PolySet *ps;
+		const int *idx;
+		int n;
+	};
+
+	/*!
+		Polygons as one flat buffer of indices into the vertex arrays of the
+		PolySet. Polygon i uses indices[offsets[i]] to indices[offsets[i+1]-1].
+	*/
+	class PolygonList
+	{
+	public:
+		QVector<int> indices;
+		QVector<int> offsets;
+
+		PolygonList(const PolySet *ps) : ps(ps) { offsets.append(0); }
+		int size() const { return offsets.size() - 1; }
+		bool isEmpty() const { return offsets.size() == 1; }
+		Polygon operator[](int i) const {
+			return Polygon(ps, indices.constData() + offsets[i], offsets[i+1] - offsets[i]);
+		}
+		Polygon at(int i) const { return (*this)[i]; }
+		Polygon last() const { return (*this)[size() - 1]; }
+
+		void append_poly() { offsets.append(indices.size()); }
+		void append_index(int v) { indices.append(v); offsets.last()++; }
+		void insert_index(int v) { indices.insert(offsets[offsets.size() - 2], v); offsets.last()++; }
+	private:
+		const PolySet *ps;
+	};
+
+	// Vertex coordinates as separate arrays, shared by polygons and borders
+	QVector<double> vx, vy, vz;
+	PolygonList polygons;
+	PolygonList borders;
+	Grid3d<int> grid;  // vertex index + 1 by grid position
 
 	bool is2d;
 	int convexity;
@@ -37,9 +85,15 @@ public:
 	PolySet();
 	~PolySet();
 
+	int vertex_count() const { return vx.size(); }
+	Point vertex(int i) const { return Point(vx[i], vy[i], vz[i]); }
+	int add_vertex(double x, double y, double z);
+	int add_vertex(const Point &p);
+
 	void append_poly();
 	void append_vertex(double x, double y, double z);
 	void insert_vertex(double x, double y, double z);
+	void append_triangle(int v0, int v1, int v2);
 
 	void append_vertex(double x, double y) {
 		append_vertex(x, y, 0.0);
@@ -48,6 +102,10 @@ public:
 		insert_vertex(x, y, 0.0);
 	}
 
+	void append_border();
+	void append_border_vertex(double x, double y, double z);
+	void insert_border_vertex(double x, double y, double z);
+
 	enum colormode_e {
 		COLORMODE_NONE,
 		COLORMODE_MATERIAL,
@@ -74,8 +132,10 @@ public:
 	};
 
 	static QCache<QString,ps_cache_entry> ps_cache;
+	// Entries kept out of ps_cache's reach while a render needs them
+	static QHash<QString,ps_cache_entry*> ps_pinned;
 
-	void render_surface(colormode_e colormode, csgmode_e csgmode, const Float20 &m, GLint *shaderinfo = NULL) const;
+	void render_surface(colormode_e colormode, csgmode_e csgmode, bool mirrored, GLint *shaderinfo = NULL) const;
 	void render_edges(colormode_e colormode, csgmode_e csgmode) const;
 
 #ifdef ENABLE_CGAL
@@ -85,6 +145,10 @@ public:
 	int refcount;
 	PolySet *link();
 	void unlink();
+
+private:
+	PolySet(const PolySet &);
+	PolySet &operator=(const PolySet &);
 };
 
 #endif
@@ -32,7 +32,6 @@
 #include <assert.h>
 #include <boost/make_shared.hpp>
 #include <boost/foreach.hpp>
-#include "tostring.h"
 
 using boost::make_shared;
 
@@ -300,35 +299,37 @@ PolySet *CircleNode::render_polyset(render_mode_e) const {
 PolySet *PolygonNode::render_polyset(render_mode_e) const {
   PolySet *p = new PolySet();
   DxfData dd;
+  dd.points.reserve(points.size());
   BOOST_FOREACH(const Float2 &p, points) {
-	  dd.points.append(DxfData::Point(p[0], p[1]));
+	  dd.points.push_back(DxfData::Point(p[0], p[1]));
   }
 
   if (paths.size() == 0) {
-    dd.paths.append(DxfData::Path());
-    for (unsigned int i=0; i<points.size(); i++) {
-      DxfData::Point *p = &dd.points[i];
-      dd.paths.last().points.append(p);
-    }
-    if (dd.paths.last().points.size() > 0) {
-	dd.paths.last().points.append(dd.paths.last().points.first());
-	dd.paths.last().is_closed = true;
+    dd.paths.push_back(DxfData::Path());
+    DxfData::Path &path = dd.paths.back();
+    path.indices.reserve(points.size() + 1);
+    for (unsigned int i=0; i<points.size(); i++)
+      path.indices.push_back(i);
+    if (!path.indices.empty()) {
+	path.indices.push_back(path.indices.front());
+	path.is_closed = true;
     }
   }
   else {
+    dd.paths.reserve(paths.size());
     BOOST_FOREACH(const VecPoints &p, paths) {
-      dd.paths.append(DxfData::Path());
+      dd.paths.push_back(DxfData::Path());
+      DxfData::Path &path = dd.paths.back();
+      path.indices.reserve(p.size() + 1);
       BOOST_FOREACH(unsigned int idx, p) {
-	if (idx < (unsigned int)dd.points.size()) {
-	  DxfData::Point *p = &dd.points[idx];
-	  dd.paths.last().points.append(p);
-	}
+	if (idx < (unsigned int)dd.points.size())
+	  path.indices.push_back(idx);
       }
-      if (dd.paths.last().points.isEmpty()) {
-	dd.paths.removeLast();
+      if (path.indices.empty()) {
+	dd.paths.pop_back();
       } else {
-	dd.paths.last().points.append(dd.paths.last().points.first());
-	dd.paths.last().is_closed = true;
+	path.indices.push_back(path.indices.front());
+	path.is_closed = true;
       }
     }
   }
@@ -339,87 +340,132 @@ PolySet *PolygonNode::render_polyset(render_mode_e) const {
   return p;
 }
 
-QString PrimitiveNode::dump(QString indent) const
+void PrimitiveNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("PrimitiveNode");
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  out << "PrimitiveNode";
 }
 
+void CubeNode::dump_statement(QTextStream &out) const
+{
+  QString text;
+  text.sprintf("cube(size = [%g, %g, %g], center = %s)", dim[0], dim[1], dim[2], center ? "true" : "false");
+  out << text;
+}
 
-QString CubeNode::dump(QString indent) const
+void SphereNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("cube(size = [%g, %g, %g], center = %s);\n", dim[0], dim[1], dim[2], center ? "true" : "false");
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  QString text;
+  text.sprintf("sphere($fn = %g, $fa = %g, $fs = %g, r = %g)", fn, fa, fs, r);
+  out << text;
 }
 
-QString SphereNode::dump(QString indent) const
+void CylinderNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("sphere($fn = %g, $fa = %g, $fs = %g, r = %g);\n", fn, fa, fs, r);
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  QString text;
+  text.sprintf("cylinder($fn = %g, $fa = %g, $fs = %g, h = %g, r1 = %g, r2 = %g, center = %s)", fn, fa, fs, h, r1, r2, center ? "true" : "false");
+  out << text;
 }
 
+/*
+  Writers for the point and index lists of polyhedra and polygons, in
+  the same format as toString(), but straight into the stream.
+*/
+static void dump_value(QTextStream &out, double v)
+{
+  out << v;
+}
 
-QString CylinderNode::dump(QString indent) const
+static void dump_value(QTextStream &out, unsigned int v)
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("cylinder($fn = %g, $fa = %g, $fs = %g, h = %g, r1 = %g, r2 = %g, center = %s);\n", fn, fa, fs, h, r1, r2, center ? "true" : "false");
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
+  out << v;
+}
+
+template<typename T, std::size_t N>
+static void dump_value(QTextStream &out, const boost::array<T,N> &list)
+{
+  out << "[";
+  for (std::size_t i = 0; i < N; i++) {
+    if (i > 0)
+      out << ", ";
+    dump_value(out, list[i]);
   }
-  return dump_cache;
+  out << "]";
 }
 
-QString PolyhedronNode::dump(QString indent) const
+template<typename T>
+static void dump_value(QTextStream &out, const std::vector<T> &list)
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("polyhedron(points = %s, triangles = %s, convexity = %d);\n", toString(points).c_str(), toString(triangles).c_str(), convexity);
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
+  out << "[";
+  for (std::size_t i = 0; i < list.size(); i++) {
+    if (i > 0)
+      out << ", ";
+    dump_value(out, list[i]);
   }
-  return dump_cache;
+  out << "]";
 }
 
+/*
+  Adds the raw contents of a point or index list to a hash
+*/
+template<typename T>
+static void hash_vector(QCryptographicHash &hash, const std::vector<T> &list)
+{
+  unsigned int n = list.size();
+  hash.addData((const char*)&n, sizeof(n));
+  if (n > 0)
+    hash.addData((const char*)&list[0], n * sizeof(T));
+}
 
-QString SquareNode::dump(QString indent) const
+static void hash_paths(QCryptographicHash &hash, const VecPaths &paths)
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("square(size = [%g, %g], center = %s);\n", dim[0], dim[1], center ? "true" : "false");
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  unsigned int n = paths.size();
+  hash.addData((const char*)&n, sizeof(n));
+  BOOST_FOREACH(const VecPoints &p, paths)
+    hash_vector(hash, p);
 }
 
+void PolyhedronNode::dump_statement(QTextStream &out) const
+{
+  out << "polyhedron(points = ";
+  dump_value(out, points);
+  out << ", triangles = ";
+  dump_value(out, triangles);
+  out << ", convexity = " << convexity << ")";
+}
 
-QString CircleNode::dump(QString indent) const
+void PolyhedronNode::hash_statement(QCryptographicHash &hash) const
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("circle($fn = %g, $fa = %g, $fs = %g, r = %g);\n", fn, fa, fs, r);
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  hash.addData(QString("polyhedron(convexity = %1)").arg(convexity).toUtf8());
+  hash_vector(hash, points);
+  hash_paths(hash, triangles);
+}
+
+void SquareNode::dump_statement(QTextStream &out) const
+{
+  QString text;
+  text.sprintf("square(size = [%g, %g], center = %s)", dim[0], dim[1], center ? "true" : "false");
+  out << text;
 }
 
+void CircleNode::dump_statement(QTextStream &out) const
+{
+  QString text;
+  text.sprintf("circle($fn = %g, $fa = %g, $fs = %g, r = %g)", fn, fa, fs, r);
+  out << text;
+}
 
-QString PolygonNode::dump(QString indent) const
+void PolygonNode::dump_statement(QTextStream &out) const
 {
-  if (dump_cache.isEmpty()) {
-    QString text;
-    text.sprintf("polygon(points = %s, paths = %s, convexity = %d);\n", toString(points).c_str(), toString(paths).c_str(), convexity);
-    ((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-  }
-  return dump_cache;
+  out << "polygon(points = ";
+  dump_value(out, points);
+  out << ", paths = ";
+  dump_value(out, paths);
+  out << ", convexity = " << convexity << ")";
+}
+
+void PolygonNode::hash_statement(QCryptographicHash &hash) const
+{
+  hash.addData(QString("polygon(convexity = %1)").arg(convexity).toUtf8());
+  hash_vector(hash, points);
+  hash_paths(hash, paths);
 }
@@ -40,7 +40,7 @@ public:
     static const double F_MINIMUM;
     int convexity;
     PrimitiveNode(int convex=1, const Props p=Props()) : AbstractPolyNode(p), convexity(convex) { }
-    virtual QString dump(QString indent) const;
+    virtual void dump_statement(QTextStream &out) const;
 };
 
 class CubeNode : public PrimitiveNode {
@@ -50,7 +50,7 @@ public:
 	CubeNode(const Float3 &dim, bool center=false, const Props p=Props())
 	  :PrimitiveNode(1,p), center(center), dim(dim) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
 };
 
 class SphereNode : public PrimitiveNode, public Accuracy {
@@ -60,7 +60,7 @@ public:
 	SphereNode(double r, const Accuracy &acc=Accuracy(), const Props p=Props())
 	  :PrimitiveNode(1,p), Accuracy(acc), r(r) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
 };
 
 class CylinderNode : public PrimitiveNode, public Accuracy {
@@ -74,7 +74,7 @@ public:
 	CylinderNode(double r, double h, bool center=false, const Accuracy &acc=Accuracy(), const Props p=Props())
 	  :PrimitiveNode(1,p), Accuracy(acc), center(center), r1(r), r2(r), h(h) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
 };
 
 class PolyhedronNode : public PrimitiveNode {
@@ -84,7 +84,8 @@ public:
 	PolyhedronNode(const Vec3D &points, const VecPaths &triangles, int convexity, const Props p=Props())
 	  :PrimitiveNode(convexity,p), points(points), triangles(triangles) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual void hash_statement(QCryptographicHash &hash) const;
 };
 
 class SquareNode : public PrimitiveNode {
@@ -94,7 +95,7 @@ public:
 	SquareNode(const Float2 &dim, bool center, const Props p=Props())
 	  :PrimitiveNode(1,p), center(center), dim(dim) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
 };
 
 class CircleNode : public PrimitiveNode, public Accuracy {
@@ -104,7 +105,7 @@ public:
 	CircleNode(double r, const Accuracy &acc=Accuracy(), const Props p=Props())
 	  :PrimitiveNode(1,p), Accuracy(acc), r(r) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
 };
 
 class PolygonNode : public PrimitiveNode {
@@ -114,7 +115,8 @@ public:
 	PolygonNode(const Vec2D &points, const VecPaths &paths, int convexity, const Props p=Props())
 	  :PrimitiveNode(convexity,p), points(points), paths(paths) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual void hash_statement(QCryptographicHash &hash) const;
 };
 
 
@@ -1,7 +1,9 @@
 #include "printutils.h"
 #include <stdio.h>
+#include <QTime>
 
 QList<QString> print_messages_stack;
+static QList<QTime> print_messages_timers;
 OutputHandlerFunc *outputhandler = NULL;
 void *outputhandler_data = NULL;
 
@@ -14,12 +16,15 @@ void set_output_handler(OutputHandlerFunc *newhandler, void *userdata)
 void print_messages_push()
 {
 	print_messages_stack.append(QString());
+	print_messages_timers.append(QTime());
+	print_messages_timers.last().start();
 }
 
 void print_messages_pop()
 {
 	QString msg = print_messages_stack.last();
 	print_messages_stack.removeLast();
+	print_messages_timers.removeLast();
 	if (print_messages_stack.size() > 0 && !msg.isEmpty()) {
 		if (!print_messages_stack.last().isEmpty())
 			print_messages_stack.last() += "\n";
@@ -27,6 +32,17 @@ void print_messages_pop()
 	}
 }
 
+/*!
+	Milliseconds since the innermost print_messages_push(), i.e. since the
+	node currently being rendered started.
+*/
+int print_messages_elapsed()
+{
+	if (print_messages_timers.isEmpty())
+		return 0;
+	return print_messages_timers.last().elapsed();
+}
+
 void PRINT(const QString &msg)
 {
 	if (msg.isEmpty())
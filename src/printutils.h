@@ -13,6 +13,7 @@ void set_output_handler(OutputHandlerFunc *newhandler, void *userdata);
 extern QList<QString> print_messages_stack;
 void print_messages_push();
 void print_messages_pop();
+int print_messages_elapsed();
 
 void PRINT(const QString &msg);
 #define PRINTF(_fmt, ...) do { QString _m; _m.sprintf(_fmt, ##__VA_ARGS__); PRINT(_m); } while (0)
@@ -60,14 +60,13 @@ PolySet *ProjectionNode::render_polyset(render_mode_e) const
 	ps->convexity = this->convexity;
 	ps->is2d = true;
 
-	CGAL_Nef_polyhedron N;
-	N.dim = 3;
+	CGAL_Nef_polyhedron N = CGAL_Nef_polyhedron3();
 	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
   try {
 	foreach(AbstractNode::Pointer v, this->children) {
 		if (v->props.background)
 			continue;
-		N.p3 += v->render_cgal_nef_polyhedron().p3;
+		N += v->render_cgal_nef_polyhedron();
 	}
   }
   catch (CGAL::Assertion_exception e) {
@@ -122,8 +121,8 @@ PolySet *ProjectionNode::render_polyset(render_mode_e) const
 		cube->unlink();
 
 		// N.p3 *= CGAL_Nef_polyhedron3(CGAL_Plane(0, 0, 1, 0), CGAL_Nef_polyhedron3::INCLUDED);
-		N.p3 *= Ncube.p3;
-		if (!N.p3.is_simple()) {
+		N *= Ncube;
+		if (!N.p3->is_simple()) {
 			PRINTF("WARNING: Body of projection(cut = true) isn't valid 2-manifold! Modify your design..");
 			goto cant_project_non_simple_polyhedron;
 		}
@@ -155,15 +154,14 @@ PolySet *ProjectionNode::render_polyset(render_mode_e) const
 	}
 	else
 	{
-		if (!N.p3.is_simple()) {
+		if (!N.p3->is_simple()) {
 			PRINTF("WARNING: Body of projection(cut = false) isn't valid 2-manifold! Modify your design..");
 			goto cant_project_non_simple_polyhedron;
 		}
 
 		PolySet *ps3 = new PolySet();
 		cgal_nef3_to_polyset(ps3, &N);
-		CGAL_Nef_polyhedron np;
-		np.dim = 2;
+		CGAL_Nef_polyhedron np = CGAL_Nef_polyhedron2();
 		for (int i = 0; i < ps3->polygons.size(); i++)
 		{
 			int min_x_p = -1;
@@ -195,13 +193,13 @@ PolySet *ProjectionNode::render_polyset(render_mode_e) const
 			for (int j = 0; j < ps3->polygons[i].size(); j++) {
 				double x = ps3->polygons[i][j].x;
 				double y = ps3->polygons[i][j].y;
-				CGAL_Nef_polyhedron2::Point p = CGAL_Nef_polyhedron2::Point(x, y);
+				CGAL_Nef_polyhedron2::Point p = CGAL_Nef_polyhedron2::Point(cgal_quantize(x), cgal_quantize(y));
 				if (at > bt)
 					plist.push_front(p);
 				else
 					plist.push_back(p);
 			}
-			np.p2 += CGAL_Nef_polyhedron2(plist.begin(), plist.end(),
+			np.edit2() += CGAL_Nef_polyhedron2(plist.begin(), plist.end(),
 					CGAL_Nef_polyhedron2::INCLUDED);
 		}
 		DxfData dxf(np);
@@ -229,17 +227,11 @@ PolySet *ProjectionNode::render_polyset(render_mode_e) const
 
 #endif // ENABLE_CGAL
 
-QString ProjectionNode::dump(QString indent) const
+void ProjectionNode::dump_statement(QTextStream &out) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text;
-		text.sprintf("projection(cut = %s, convexity = %d) {\n",
-				this->cut_mode ? "true" : "false", this->convexity);
-		foreach (AbstractNode::Pointer v, this->children)
-			text += v->dump(indent + QString("\t"));
-		text += indent + "}\n";
-		((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-	}
-	return dump_cache;
+	QString text;
+	text.sprintf("projection(cut = %s, convexity = %d)",
+			this->cut_mode ? "true" : "false", this->convexity);
+	out << text;
 }
 
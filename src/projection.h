@@ -37,7 +37,10 @@ public:
 	ProjectionNode(const AbstractNode::NodeList &children, bool cut_mode, int convexity, const Props p=Props()) 
 	  : AbstractPolyNode(p, children), convexity(convexity), cut_mode(cut_mode) {}
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+		return clone_as(this, children);
+	}
 };
 
 
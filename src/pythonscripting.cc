@@ -13,7 +13,11 @@
 #include "surface.h"
 #include "import.h"
 #include "projection.h"
+#include "offset.h"
+#include "simplify.h"
 #include "cgaladv.h"
+#include "printutils.h"
+#include <QHash>
 #include <boost/python.hpp>
 #include <boost/make_shared.hpp>
 
@@ -42,6 +46,11 @@ BOOST_PARAMETER_KEYWORD(tag, origin)
 BOOST_PARAMETER_KEYWORD(tag, scale)
 BOOST_PARAMETER_KEYWORD(tag, convexity)
 BOOST_PARAMETER_KEYWORD(tag, slices)
+BOOST_PARAMETER_KEYWORD(tag, angle)
+BOOST_PARAMETER_KEYWORD(tag, delta)
+BOOST_PARAMETER_KEYWORD(tag, chamfer)
+BOOST_PARAMETER_KEYWORD(tag, max_error)
+BOOST_PARAMETER_KEYWORD(tag, target_faces)
 BOOST_PARAMETER_KEYWORD(tag, cut_mode)
 BOOST_PARAMETER_KEYWORD(tag, name)
 
@@ -454,7 +463,7 @@ public:
 	AbstractNode::NodeList(), QString::fromStdString(args[file]), 
 	QString::fromStdString(args[layer|std::string()]),
 	list2StdArray<Float2>(args[origin|empty_list]), args[scale|1.0],
-	args[convexity|5], ctx.getAcc()
+	args[convexity|5], args[angle|360.0], ctx.getAcc()
       );
       initAcc(p);
       node = p;     
@@ -468,7 +477,8 @@ public:
       (optional (layer, (std::string))
 	(origin, (list))
 	(scale, (double))
-	(convexity, (unsigned int)))
+	(convexity, (unsigned int))
+	(angle, (double)))
   )
 };
 
@@ -484,7 +494,7 @@ public:
       DxfRotateExtrudeNode::Pointer p = make_shared<DxfRotateExtrudeNode>(
 	childlist, 
 	QString(), QString(), Float2(), 1.0,
-	args[convexity|5], ctx.getAcc()
+	args[convexity|5], args[angle|360.0], ctx.getAcc()
       );
       initAcc(p);
       node = p;     
@@ -495,6 +505,7 @@ class PyRotateExtrudeNode: public PyRotateExtrudeNodeBase {
 public:
   BOOST_PARAMETER_CONSTRUCTOR(PyRotateExtrudeNode, (PyRotateExtrudeNodeBase), tag,
       (optional (convexity, (unsigned int))
+	(angle, (double))
 	(child, (PyAbstractNode))
 	(children, (list)))
   )
@@ -569,6 +580,62 @@ public:
   )
 };
 
+class PyOffsetNodeBase: public PyAbstractNode, public PyNodeAccuracy {
+public:
+    template <class ArgumentPack>
+    PyOffsetNodeBase(ArgumentPack const& args) {
+      AbstractNode::NodeList childlist;
+      const list &lchildren = args[children|empty_list];
+      if (len(lchildren) > 0) childlist = list2NodeList(lchildren);
+      else childlist.append(args[child|PyAbstractNode()].getNode());
+
+      double rad = args[r|std::numeric_limits<double>::quiet_NaN()];
+      double d = args[delta|.0];
+      OffsetNode::join_type_e join_type = args[chamfer|false] ? OffsetNode::JOIN_CHAMFER : OffsetNode::JOIN_MITER;
+      if (!myIsNaN(rad)) {
+	d = rad;
+	join_type = OffsetNode::JOIN_ROUND;
+      }
+      OffsetNode::Pointer p = make_shared<OffsetNode>(childlist, d, join_type, args[convexity|5], ctx.getAcc());
+      initAcc(p);
+      node = p;
+    }
+};
+
+class PyOffsetNode: public PyOffsetNodeBase {
+public:
+  BOOST_PARAMETER_CONSTRUCTOR(PyOffsetNode, (PyOffsetNodeBase), tag,
+      (optional (r, (double))
+	(delta, (double))
+	(chamfer, (bool))
+	(convexity, (unsigned int))
+	(child, (PyAbstractNode))
+	(children, (list)))
+  )
+};
+
+class PySimplifyNodeBase: public PyAbstractNode {
+public:
+    template <class ArgumentPack>
+    PySimplifyNodeBase(ArgumentPack const& args) {
+      AbstractNode::NodeList childlist;
+      const list &lchildren = args[children|empty_list];
+      if (len(lchildren) > 0) childlist = list2NodeList(lchildren);
+      else childlist.append(args[child|PyAbstractNode()].getNode());
+      node = make_shared<SimplifyNode>(childlist, args[max_error|-1.0], args[target_faces|-1], args[convexity|5]);
+    }
+};
+
+class PySimplifyNode: public PySimplifyNodeBase {
+public:
+  BOOST_PARAMETER_CONSTRUCTOR(PySimplifyNode, (PySimplifyNodeBase), tag,
+      (optional (max_error, (double))
+	(target_faces, (int))
+	(convexity, (unsigned int))
+	(child, (PyAbstractNode))
+	(children, (list)))
+  )
+};
 
 class PyMinkowskiNode: public PyAbstractNode {
 public:
@@ -671,12 +738,12 @@ BOOST_PYTHON_MODULE(openscad) {
   class_<PyDxfRotateExtrudeNodeBase, bases<PyAbstractNode, PyNodeAccuracy> >("_DXFRotateExtrudeBase", no_init);
   class_<PyDxfRotateExtrudeNode, bases<PyDxfRotateExtrudeNodeBase> >("dxf_rotate_extrude", no_init)
     .def(py::init< mpl::vector< tag::file(std::string), tag::layer*(std::string),
-	 tag::origin*(list), tag::scale*(double), tag::convexity*(unsigned int)> >());
+	 tag::origin*(list), tag::scale*(double), tag::convexity*(unsigned int), tag::angle*(double)> >());
     
   class_<PyRotateExtrudeNodeBase, bases<PyAbstractNode, PyNodeAccuracy> >("_RotateExtrudeBase", no_init);
   class_<PyRotateExtrudeNode, bases<PyRotateExtrudeNodeBase> >("rotate_extrude", no_init)
-    .def(py::init< mpl::vector< tag::convexity*(unsigned int), tag::child(PyAbstractNode) > >())
-    .def(py::init< mpl::vector< tag::convexity*(unsigned int), tag::children(list) > >());
+    .def(py::init< mpl::vector< tag::convexity*(unsigned int), tag::angle*(double), tag::child(PyAbstractNode) > >())
+    .def(py::init< mpl::vector< tag::convexity*(unsigned int), tag::angle*(double), tag::children(list) > >());
 
   class_<PySurfaceNodeBase, bases<PyAbstractNode> >("_SurfaceNodeBase", no_init);
   class_<PySurfaceNode, bases<PySurfaceNodeBase> >("surface", no_init)
@@ -695,6 +762,20 @@ BOOST_PYTHON_MODULE(openscad) {
     .def(py::init< mpl::vector< tag::convexity*(unsigned int), tag::cut_mode*(bool), tag::child(PyAbstractNode) > >())
     .def(py::init< mpl::vector< tag::convexity*(unsigned int), tag::cut_mode*(bool), tag::children(list) > >());
   
+  class_<PyOffsetNodeBase, bases<PyAbstractNode, PyNodeAccuracy> >("_OffsetBase", no_init);
+  class_<PyOffsetNode, bases<PyOffsetNodeBase> >("offset", no_init)
+    .def(py::init< mpl::vector< tag::r*(double), tag::delta*(double), tag::chamfer*(bool),
+	 tag::convexity*(unsigned int), tag::child(PyAbstractNode) > >())
+    .def(py::init< mpl::vector< tag::r*(double), tag::delta*(double), tag::chamfer*(bool),
+	 tag::convexity*(unsigned int), tag::children(list) > >());
+
+  class_<PySimplifyNodeBase, bases<PyAbstractNode> >("_SimplifyBase", no_init);
+  class_<PySimplifyNode, bases<PySimplifyNodeBase> >("simplify", no_init)
+    .def(py::init< mpl::vector< tag::max_error*(double), tag::target_faces*(int),
+	 tag::convexity*(unsigned int), tag::child(PyAbstractNode) > >())
+    .def(py::init< mpl::vector< tag::max_error*(double), tag::target_faces*(int),
+	 tag::convexity*(unsigned int), tag::children(list) > >());
+
   class_<PyMinkowskiNode, bases<PyAbstractNode> >("minkowski", init<list, optional<unsigned int> >());
     
     
@@ -710,6 +791,47 @@ BOOST_PYTHON_MODULE(openscad) {
   def("DxfCross", pyDxfCross, pyDxfCross_overloads());
 }
 
+/*!
+  Hash-conses a finished tree: structurally identical subtrees, i.e. nodes
+  with the same parameters, the same modifiers and the same (already
+  shared) children, are replaced by one shared node. Scripts calling the
+  same function many times then render, dump and cache each distinct
+  subtree only once. This runs after the script has finished, as nodes
+  can still be changed from Python (fn, highlight, ..) until then.
+*/
+class NodeInterner {
+  QHash<QString, AbstractNode::Pointer> canonical;
+  QHash<const AbstractNode*, AbstractNode::Pointer> visited;
+public:
+  int shared;
+  NodeInterner() : shared(0) {}
+
+  AbstractNode::Pointer intern(const AbstractNode::Pointer &node) {
+    if (visited.contains(node.get())) return visited[node.get()];
+    for (int i = 0; i < node->children.size(); i++)
+      node->children[i] = intern(node->children[i]);
+
+    // The own parameters of a node are what it hashes without its children
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    node->hash_statement(hash);
+    QString key = hash.result().toHex();
+
+    key += QString("|%1%2%3|").arg(node->props.root).arg(node->props.highlight).arg(node->props.background);
+    foreach (AbstractNode::Pointer v, node->children)
+      key += QString::number(v->idx) + ",";
+
+    AbstractNode::Pointer result = node;
+    if (canonical.contains(key)) {
+      result = canonical[key];
+      shared++;
+    } else {
+      canonical.insert(key, node);
+    }
+    visited.insert(node.get(), result);
+    return result;
+  }
+};
+
 PythonScript::PythonScript(double time) {
   PyImport_AppendInittab(const_cast<char*>(PyContext::nsopenscad.c_str()), &initopenscad );
   Py_Initialize();
@@ -728,7 +850,11 @@ AbstractNode::Pointer PythonScript::evaluate(const std::string &code, const std:
   try {
     exec(code.c_str(), ctx.main_namespace);
     PyAbstractNode &resNode = extract<PyAbstractNode&>(ctx.getResult());
-    return resNode.getNode();
+    NodeInterner interner;
+    AbstractNode::Pointer root = interner.intern(resNode.getNode());
+    if (interner.shared > 0)
+      PRINTF("Shared %d identical subtrees.", interner.shared);
+    return root;
   } catch(error_already_set) {
 //    PyErr_Print();
   }
@@ -8,13 +8,12 @@ class OpenCSGPrim : public OpenCSG::Primitive
 public:
 	OpenCSGPrim(OpenCSG::Operation operation, unsigned int convexity) :
 			OpenCSG::Primitive(operation, convexity) { }
-	PolySet *p;
-	Float20Ptr m;
+	const CSGChain::Element *e;
 	int csgmode;
 	virtual void render() {
 		glPushMatrix();
-		glMultMatrixd(m->c_array());
-		p->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), *m);
+		glMultMatrixf(e->m.data());
+		e->polyset->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), e->mirrored);
 		glPopMatrix();
 	}
 };
@@ -22,12 +21,13 @@ public:
 void renderCSGChainviaOpenCSG(CSGChain *chain, GLint *shaderinfo, bool highlight, bool background)
 {
 	std::vector<OpenCSG::Primitive*> primitives;
+	const CSGChain::Element *elements = chain->size() > 0 ? &chain->elements[0] : NULL;
 	int j = 0;
 	for (int i = 0;; i++)
 	{
-		bool last = i == chain->polysets.size();
+		bool last = i == chain->size();
 
-		if (last || chain->types[i] == CSGTerm::TYPE_UNION)
+		if (last || elements[i].type == CSGTerm::TYPE_UNION)
 		{
 			if (j+1 != i) {
 				OpenCSG::render(primitives);
@@ -36,26 +36,27 @@ void renderCSGChainviaOpenCSG(CSGChain *chain, GLint *shaderinfo, bool highlight
 			if (shaderinfo)
 				glUseProgram(shaderinfo[0]);
 			for (; j < i; j++) {
-				Float20 &m = *chain->matrices[j];
+				const CSGChain::Element &e = elements[j];
 				glPushMatrix();
-				glMultMatrixd(m.c_array());
-				int csgmode = chain->types[j] == CSGTerm::TYPE_DIFFERENCE ? PolySet::CSGMODE_DIFFERENCE : PolySet::CSGMODE_NORMAL;
+				glMultMatrixf(e.m.data());
+				int csgmode = e.type == CSGTerm::TYPE_DIFFERENCE ? PolySet::CSGMODE_DIFFERENCE : PolySet::CSGMODE_NORMAL;
 				if (highlight) {
-					chain->polysets[j]->render_surface(PolySet::COLORMODE_HIGHLIGHT, PolySet::csgmode_e(csgmode + 20), m, shaderinfo);
+					e.polyset->render_surface(PolySet::COLORMODE_HIGHLIGHT, PolySet::csgmode_e(csgmode + 20), e.mirrored, shaderinfo);
 				} else if (background) {
-					chain->polysets[j]->render_surface(PolySet::COLORMODE_BACKGROUND, PolySet::csgmode_e(csgmode + 10), m, shaderinfo);
-				} else if (m[16] >= 0 || m[17] >= 0 || m[18] >= 0 || m[19] >= 0) {
+					e.polyset->render_surface(PolySet::COLORMODE_BACKGROUND, PolySet::csgmode_e(csgmode + 10), e.mirrored, shaderinfo);
+				} else if (e.has_color()) {
 					// User-defined color from source
-					glColor4d(m[16], m[17], m[18], m[19]);
+					const float *c = e.color.data();
+					glColor4f(c[0], c[1], c[2], c[3]);
 					if (shaderinfo) {
-						glUniform4f(shaderinfo[1], m[16], m[17], m[18], m[19]);
-						glUniform4f(shaderinfo[2], (m[16]+1)/2, (m[17]+1)/2, (m[18]+1)/2, 1.0);
+						glUniform4f(shaderinfo[1], c[0], c[1], c[2], c[3]);
+						glUniform4f(shaderinfo[2], (c[0]+1)/2, (c[1]+1)/2, (c[2]+1)/2, 1.0);
 					}
-					chain->polysets[j]->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), m, shaderinfo);
-				} else if (chain->types[j] == CSGTerm::TYPE_DIFFERENCE) {
-					chain->polysets[j]->render_surface(PolySet::COLORMODE_CUTOUT, PolySet::csgmode_e(csgmode), m, shaderinfo);
+					e.polyset->render_surface(PolySet::COLORMODE_NONE, PolySet::csgmode_e(csgmode), e.mirrored, shaderinfo);
+				} else if (e.type == CSGTerm::TYPE_DIFFERENCE) {
+					e.polyset->render_surface(PolySet::COLORMODE_CUTOUT, PolySet::csgmode_e(csgmode), e.mirrored, shaderinfo);
 				} else {
-					chain->polysets[j]->render_surface(PolySet::COLORMODE_MATERIAL, PolySet::csgmode_e(csgmode), m, shaderinfo);
+					e.polyset->render_surface(PolySet::COLORMODE_MATERIAL, PolySet::csgmode_e(csgmode), e.mirrored, shaderinfo);
 				}
 				glPopMatrix();
 			}
@@ -71,11 +72,11 @@ void renderCSGChainviaOpenCSG(CSGChain *chain, GLint *shaderinfo, bool highlight
 		if (last)
 			break;
 
-		OpenCSGPrim *prim = new OpenCSGPrim(chain->types[i] == CSGTerm::TYPE_DIFFERENCE ?
-				OpenCSG::Subtraction : OpenCSG::Intersection, chain->polysets[i]->convexity);
-		prim->p = chain->polysets[i];
-		prim->m = chain->matrices[i];
-		prim->csgmode = chain->types[i] == CSGTerm::TYPE_DIFFERENCE ? PolySet::CSGMODE_DIFFERENCE : PolySet::CSGMODE_NORMAL;
+		const CSGChain::Element &e = elements[i];
+		OpenCSGPrim *prim = new OpenCSGPrim(e.type == CSGTerm::TYPE_DIFFERENCE ?
+				OpenCSG::Subtraction : OpenCSG::Intersection, e.polyset->convexity);
+		prim->e = &e;
+		prim->csgmode = e.type == CSGTerm::TYPE_DIFFERENCE ? PolySet::CSGMODE_DIFFERENCE : PolySet::CSGMODE_NORMAL;
 		if (highlight)
 			prim->csgmode += 20;
 		else if (background)
@@ -62,10 +62,8 @@ CGAL_Nef_polyhedron RenderNode::render_cgal_nef_polyhedron() const
 			N = v->render_cgal_nef_polyhedron();
 			if (N.dim != 0)
 				first = false;
-		} else if (N.dim == 2) {
-			N.p2 += v->render_cgal_nef_polyhedron().p2;
-		} else if (N.dim == 3) {
-			N.p3 += v->render_cgal_nef_polyhedron().p3;
+		} else {
+			N += v->render_cgal_nef_polyhedron();
 		}
 		v->progress_report();
 	}
@@ -123,7 +121,7 @@ CSGTerm *AbstractNode::render_csg_term_from_nef(const Float20 &m, QVector<CSGTer
 
 	if (N.dim == 3)
 	{
-		if (!N.p3.is_simple()) {
+		if (!N.p3->is_simple()) {
 			PRINTF("WARNING: Result of %s() isn't valid 2-manifold! Modify your design..", statement);
 			return NULL;
 		}
@@ -131,7 +129,7 @@ CSGTerm *AbstractNode::render_csg_term_from_nef(const Float20 &m, QVector<CSGTer
 		ps = new PolySet();
 		
 		CGAL_Polyhedron P;
-		N.p3.convert_to_Polyhedron(P);
+		N.p3->convert_to_Polyhedron(P);
 
 		typedef CGAL_Polyhedron::Vertex Vertex;
 		typedef CGAL_Polyhedron::Vertex_const_iterator VCI;
@@ -201,14 +199,8 @@ CSGTerm *RenderNode::render_csg_term(const Float20 &m, QVector<CSGTerm*> *highli
 
 #endif
 
-QString RenderNode::dump(QString indent) const
+void RenderNode::dump_statement(QTextStream &out) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text = indent + QString("n%1: ").arg(idx) + QString("render(convexity = %1) {\n").arg(QString::number(convexity));
-		foreach (AbstractNode::Pointer v, children)
-			text += v->dump(indent + QString("\t"));
-		((AbstractNode*)this)->dump_cache = text + indent + "}\n";
-	}
-	return dump_cache;
+	out << QString("render(convexity = %1)").arg(QString::number(convexity));
 }
 
@@ -46,7 +46,10 @@ public:
 	virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
 #endif
 	CSGTerm *render_csg_term(const Float20 &m, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+		return clone_as(this, children);
+	}
 };
 
 #endif
\ No newline at end of file
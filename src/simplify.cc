@@ -0,0 +1,399 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "simplify.h"
+#include "printutils.h"
+#include "polyset.h"
+#include "grid.h"
+#include "progress.h"
+#ifdef ENABLE_CGAL
+#  include "cgal.h"
+#  include "export.h" // cgal_nef3_to_polyset()
+#endif
+
+#include <QHash>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+/*!
+	Symmetric 4x4 matrix summing up the squared distances to a set of planes
+*/
+struct quadric_t {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	quadric_t() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) { }
+	void add_plane(double a, double b, double c, double d) {
+		a2 += a*a; ab += a*b; ac += a*c; ad += a*d;
+		b2 += b*b; bc += b*c; bd += b*d;
+		c2 += c*c; cd += c*d;
+		d2 += d*d;
+	}
+	quadric_t &operator+=(const quadric_t &q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+		return *this;
+	}
+	double eval(const PolySet::Point &p) const {
+		double e = a2*p.x*p.x + 2*ab*p.x*p.y + 2*ac*p.x*p.z + 2*ad*p.x +
+				b2*p.y*p.y + 2*bc*p.y*p.z + 2*bd*p.y +
+				c2*p.z*p.z + 2*cd*p.z + d2;
+		return e > 0 ? e : 0;
+	}
+	/*!
+		Finds the point with the smallest error. Returns false if the
+		system is (close to) singular.
+	*/
+	bool optimum(PolySet::Point &p) const {
+		double det = a2*(b2*c2 - bc*bc) - ab*(ab*c2 - bc*ac) + ac*(ab*bc - b2*ac);
+		if (fabs(det) < 1e-12)
+			return false;
+		p.x = (-ad*(b2*c2 - bc*bc) + ab*(bd*c2 - bc*cd) - ac*(bd*bc - b2*cd)) / det;
+		p.y = (-a2*(bd*c2 - cd*bc) + ad*(ab*c2 - bc*ac) - ac*(ab*cd - bd*ac)) / det;
+		p.z = (-a2*(b2*cd - bc*bd) + ab*(ab*cd - bd*ac) - ad*(ab*bc - b2*ac)) / det;
+		return true;
+	}
+};
+
+struct collapse_t {
+	double cost;
+	int u, v, u_version, v_version;
+	PolySet::Point p;
+	bool operator<(const collapse_t &o) const { return cost > o.cost; }
+};
+
+class MeshSimplifier
+{
+public:
+	struct face_t {
+		int v[3];
+		bool removed;
+		bool has(int i) const { return v[0] == i || v[1] == i || v[2] == i; }
+	};
+
+	std::vector<PolySet::Point> pos;
+	std::vector<quadric_t> quadrics;
+	std::vector<int> version;
+	std::vector<bool> removed, locked;
+	std::vector<face_t> faces;
+	std::vector< std::vector<int> > vertex_faces;
+	std::priority_queue<collapse_t> heap;
+	int live_faces;
+
+	MeshSimplifier() : live_faces(0) { }
+
+	void add_polyset(const PolySet *ps, Grid3d<int> &grid)
+	{
+		for (int i = 0; i < ps->polygons.size(); i++) {
+			const PolySet::Polygon &poly = ps->polygons[i];
+			std::vector<int> idx;
+			for (int j = 0; j < poly.size(); j++) {
+				double x = poly[j].x, y = poly[j].y, z = poly[j].z;
+				if (!grid.has(x, y, z)) {
+					grid.align(x, y, z) = pos.size();
+					pos.push_back(PolySet::Point(x, y, z));
+				}
+				idx.push_back(grid.data(x, y, z));
+			}
+			for (int j = 2; j < (int)idx.size(); j++) {
+				face_t f;
+				f.v[0] = idx[0], f.v[1] = idx[j-1], f.v[2] = idx[j];
+				f.removed = false;
+				if (f.v[0] == f.v[1] || f.v[1] == f.v[2] || f.v[2] == f.v[0])
+					continue;
+				faces.push_back(f);
+			}
+		}
+	}
+
+	static PolySet::Point normal(const PolySet::Point &a, const PolySet::Point &b, const PolySet::Point &c)
+	{
+		double ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+		double vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+		return PolySet::Point(uy*vz - uz*vy, uz*vx - ux*vz, ux*vy - uy*vx);
+	}
+
+	void prepare()
+	{
+		int n = pos.size();
+		quadrics.assign(n, quadric_t());
+		version.assign(n, 0);
+		removed.assign(n, false);
+		locked.assign(n, false);
+		vertex_faces.assign(n, std::vector<int>());
+		live_faces = faces.size();
+
+		QHash<QPair<int,int>,int> edge_count;
+		for (int i = 0; i < (int)faces.size(); i++) {
+			const face_t &f = faces[i];
+			PolySet::Point nv = normal(pos[f.v[0]], pos[f.v[1]], pos[f.v[2]]);
+			double len = sqrt(nv.x*nv.x + nv.y*nv.y + nv.z*nv.z);
+			for (int j = 0; j < 3; j++) {
+				vertex_faces[f.v[j]].push_back(i);
+				int a = f.v[j], b = f.v[(j+1)%3];
+				edge_count[QPair<int,int>(std::min(a, b), std::max(a, b))]++;
+			}
+			if (len == 0)
+				continue;
+			double a = nv.x / len, b = nv.y / len, c = nv.z / len;
+			double d = -(a*pos[f.v[0]].x + b*pos[f.v[0]].y + c*pos[f.v[0]].z);
+			for (int j = 0; j < 3; j++)
+				quadrics[f.v[j]].add_plane(a, b, c, d);
+		}
+
+		// Border and non-manifold edges stay where they are
+		QHashIterator<QPair<int,int>,int> it(edge_count);
+		while (it.hasNext()) {
+			it.next();
+			if (it.value() != 2)
+				locked[it.key().first] = locked[it.key().second] = true;
+		}
+
+		for (int i = 0; i < (int)faces.size(); i++) {
+			for (int j = 0; j < 3; j++) {
+				int a = faces[i].v[j], b = faces[i].v[(j+1)%3];
+				if (a < b)
+					push_edge(a, b);
+			}
+		}
+	}
+
+	void neighbors(int u, std::vector<int> &out) const
+	{
+		out.clear();
+		for (int i = 0; i < (int)vertex_faces[u].size(); i++) {
+			const face_t &f = faces[vertex_faces[u][i]];
+			if (f.removed)
+				continue;
+			for (int j = 0; j < 3; j++)
+				if (f.v[j] != u)
+					out.push_back(f.v[j]);
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+
+	void push_edge(int u, int v)
+	{
+		if (locked[u] || locked[v])
+			return;
+		quadric_t q = quadrics[u];
+		q += quadrics[v];
+
+		collapse_t c;
+		c.u = u, c.v = v;
+		c.u_version = version[u], c.v_version = version[v];
+		PolySet::Point mid((pos[u].x + pos[v].x) / 2, (pos[u].y + pos[v].y) / 2, (pos[u].z + pos[v].z) / 2);
+		c.p = mid;
+		c.cost = q.eval(mid);
+		PolySet::Point cand[3];
+		int ncand = 0;
+		cand[ncand++] = pos[u];
+		cand[ncand++] = pos[v];
+		if (q.optimum(cand[ncand]))
+			ncand++;
+		for (int i = 0; i < ncand; i++) {
+			double e = q.eval(cand[i]);
+			if (e < c.cost)
+				c.cost = e, c.p = cand[i];
+		}
+		heap.push(c);
+	}
+
+	bool can_collapse(const collapse_t &c) const
+	{
+		std::vector<int> nu, nv, common;
+		neighbors(c.u, nu);
+		neighbors(c.v, nv);
+		if (nu.size() <= 3 || nv.size() <= 3)
+			return false;
+
+		// Link condition: the edge's two opposite vertices must be the only
+		// common neighbors, otherwise the collapse pinches the surface.
+		std::set_intersection(nu.begin(), nu.end(), nv.begin(), nv.end(), std::back_inserter(common));
+		if (common.size() != 2)
+			return false;
+
+		// No face may flip over or degenerate
+		for (int k = 0; k < 2; k++) {
+			int w = k == 0 ? c.u : c.v, other = k == 0 ? c.v : c.u;
+			for (int i = 0; i < (int)vertex_faces[w].size(); i++) {
+				const face_t &f = faces[vertex_faces[w][i]];
+				if (f.removed || f.has(other))
+					continue;
+				PolySet::Point p[3];
+				for (int j = 0; j < 3; j++)
+					p[j] = f.v[j] == w ? c.p : pos[f.v[j]];
+				PolySet::Point n0 = normal(pos[f.v[0]], pos[f.v[1]], pos[f.v[2]]);
+				PolySet::Point n1 = normal(p[0], p[1], p[2]);
+				double l0 = sqrt(n0.x*n0.x + n0.y*n0.y + n0.z*n0.z);
+				double l1 = sqrt(n1.x*n1.x + n1.y*n1.y + n1.z*n1.z);
+				if (l1 < GRID_FINE * GRID_FINE)
+					return false;
+				if (l0 > 0 && (n0.x*n1.x + n0.y*n1.y + n0.z*n1.z) / (l0 * l1) < 0.2)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	void collapse(const collapse_t &c)
+	{
+		int u = c.u, v = c.v;
+		pos[u] = c.p;
+		quadrics[u] += quadrics[v];
+		for (int i = 0; i < (int)vertex_faces[v].size(); i++) {
+			int fi = vertex_faces[v][i];
+			face_t &f = faces[fi];
+			if (f.removed)
+				continue;
+			if (f.has(u)) {
+				f.removed = true;
+				live_faces--;
+				continue;
+			}
+			for (int j = 0; j < 3; j++)
+				if (f.v[j] == v)
+					f.v[j] = u;
+			vertex_faces[u].push_back(fi);
+		}
+		vertex_faces[v].clear();
+		removed[v] = true;
+		version[u]++;
+
+		std::vector<int> nu;
+		neighbors(u, nu);
+		for (int i = 0; i < (int)nu.size(); i++)
+			push_edge(u, nu[i]);
+	}
+
+	void run(double max_error, int target_faces)
+	{
+		double max_cost = max_error * max_error;
+		while (!heap.empty()) {
+			if (target_faces >= 0 && live_faces <= target_faces)
+				break;
+			collapse_t c = heap.top();
+			heap.pop();
+			if (removed[c.u] || removed[c.v] || version[c.u] != c.u_version || version[c.v] != c.v_version)
+				continue;
+			if (max_error >= 0 && c.cost > max_cost)
+				break;
+			if (can_collapse(c))
+				collapse(c);
+		}
+	}
+
+	/*!
+		Adds the remaining faces to ps. Only vertices still referenced by
+		a face are added, so collapsed ones don't linger in the vertex
+		array.
+	*/
+	void to_polyset(PolySet *ps) const
+	{
+		std::vector<int> index(pos.size(), -1);
+		for (int i = 0; i < (int)faces.size(); i++) {
+			const face_t &f = faces[i];
+			if (f.removed)
+				continue;
+			int v[3];
+			for (int j = 0; j < 3; j++) {
+				if (index[f.v[j]] < 0)
+					index[f.v[j]] = ps->add_vertex(pos[f.v[j]]);
+				v[j] = index[f.v[j]];
+			}
+			ps->append_triangle(v[0], v[1], v[2]);
+		}
+	}
+};
+
+PolySet *SimplifyNode::render_polyset(render_mode_e mode) const
+{
+	QString key = mk_cache_id();
+	if (PolySet::ps_cache.contains(key)) {
+		PRINT(PolySet::ps_cache[key]->msg);
+		return PolySet::ps_cache[key]->ps->link();
+	}
+
+	print_messages_push();
+
+	MeshSimplifier ms;
+	Grid3d<int> grid(GRID_FINE);
+	foreach (AbstractNode::Pointer v, children) {
+		if (v->props.background)
+			continue;
+		PolySet *ps = NULL;
+		if (const AbstractPolyNode *pn = dynamic_cast<const AbstractPolyNode*>(v.get())) {
+			ps = pn->render_polyset(mode);
+		} else {
+#ifdef ENABLE_CGAL
+			CGAL_Nef_polyhedron N = v->render_cgal_nef_polyhedron();
+			if (N.dim == 3) {
+				if (N.p3->is_simple()) {
+					ps = new PolySet();
+					cgal_nef3_to_polyset(ps, &N);
+				} else {
+					PRINT("WARNING: Child of simplify() isn't valid 2-manifold! Modify your design..");
+				}
+			}
+#else // ENABLE_CGAL
+			PRINT("WARNING: simplify() can only handle primitives and imported meshes when compiled without CGAL support!");
+#endif // ENABLE_CGAL
+		}
+		if (!ps)
+			continue;
+		if (ps->is2d)
+			PRINT("WARNING: simplify() is only implemented for 3D objects, ignoring 2D child!");
+		else
+			ms.add_polyset(ps, grid);
+		ps->unlink();
+		v->progress_report();
+	}
+
+	int input_faces = ms.faces.size();
+	ms.prepare();
+	ms.run(max_error, target_faces);
+	PRINTF("simplify(): reduced %d to %d faces.", input_faces, ms.live_faces);
+
+	PolySet *ps = new PolySet();
+	ps->convexity = convexity;
+	ms.to_polyset(ps);
+
+	PolySet::ps_cache.insert(key, new PolySet::ps_cache_entry(ps->link()));
+	print_messages_pop();
+	progress_report();
+
+	return ps;
+}
+
+void SimplifyNode::dump_statement(QTextStream &out) const
+{
+	QString text;
+	text.sprintf("simplify(max_error = %g, target_faces = %d, convexity = %d)",
+			max_error, target_faces, convexity);
+	out << text;
+}
@@ -0,0 +1,64 @@
+#ifndef SIMPLIFY_H_
+#define SIMPLIFY_H_
+
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "node.h"
+#include "grid.h"
+
+/*!
+	Reduces the number of faces of its 3D children by quadric error edge
+	collapses. Collapsing stops once the mesh has no more than target_faces
+	faces or once the next collapse would move a vertex further than
+	max_error away from any of the planes of the faces it replaces. A
+	negative value disables the respective limit. If both are disabled,
+	max_error defaults to GRID_COARSE, which only merges faces that are
+	flat within the grid resolution. Edges on open borders or
+	at non-manifold parts of the mesh are never collapsed, so closed meshes
+	stay closed.
+*/
+class SimplifyNode : public AbstractPolyNode
+{
+public:
+	typedef shared_ptr<SimplifyNode> Pointer;
+	double max_error;
+	int target_faces;
+	int convexity;
+	SimplifyNode(const AbstractNode::NodeList &children, double max_error, int target_faces,
+		     int convexity, const Props p=Props())
+	  : AbstractPolyNode(p, children), max_error(max_error), target_faces(target_faces), convexity(convexity) {
+		if (max_error < 0 && target_faces < 0)
+			this->max_error = GRID_COARSE;
+	}
+	virtual PolySet *render_polyset(render_mode_e mode) const;
+	virtual void dump_statement(QTextStream &out) const;
+	virtual AbstractNode::Pointer clone_with_children(const AbstractNode::NodeList &children) const {
+		return clone_as(this, children);
+	}
+};
+
+#endif
@@ -147,14 +147,11 @@ PolySet *SurfaceNode::render_polyset(render_mode_e) const
 	return p;
 }
 
-QString SurfaceNode::dump(QString indent) const
+void SurfaceNode::dump_statement(QTextStream &out) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text;
-		text.sprintf("surface(file = \"%s\", center = %s);\n",
-				filename.toAscii().data(), center ? "true" : "false");
-		((AbstractNode*)this)->dump_cache = indent + QString("n%1: ").arg(idx) + text;
-	}
-	return dump_cache;
+	QString text;
+	text.sprintf("surface(file = \"%s\", center = %s)",
+			filename.toAscii().data(), center ? "true" : "false");
+	out << text;
 }
 
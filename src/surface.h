@@ -42,7 +42,7 @@ public:
 	SurfaceNode(const QString &filename, int convexity, bool center=false, const Props p=Props()) 
 	  :AbstractPolyNode(p),filename(filename), center(center), convexity(convexity) { }
 	virtual PolySet *render_polyset(render_mode_e mode) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
 };
 
 
@@ -30,16 +30,86 @@
 #include "polyset.h"
 #include "dxftess.h"
 #include "printutils.h"
+#ifdef ENABLE_CGAL
+#  include <CGAL/assertions_behaviour.h>
+#  include <CGAL/exceptions.h>
+#endif
+#include <algorithm>
+#include <sstream>
+#include <vector>
 #include <boost/make_shared.hpp>
 using boost::make_shared;
 
 
+double TransformNode::rotation_tolerance = 0;
+
 TransformNode::TransformNode(const NodeList &children, const Props p) 
   :AbstractNode(p,children) {
   for (int i = 0; i < 16; i++)
     m[i] = i % 5 == 0 ? 1.0 : 0.0;
   for (int i = 16; i < 20; i++)
     m[i] = -1;
+  for (int i = 0; i < 4; i++)
+    rational_q[i] = 0;
+}
+
+static void quaternion_to_matrix(const double q[4], double r[9])
+{
+	double w = q[0], x = q[1], y = q[2], z = q[3];
+	r[0] = w*w + x*x - y*y - z*z; r[3] = 2*(x*y - w*z);         r[6] = 2*(x*z + w*y);
+	r[1] = 2*(x*y + w*z);         r[4] = w*w - x*x + y*y - z*z; r[7] = 2*(y*z - w*x);
+	r[2] = 2*(x*z - w*y);         r[5] = 2*(y*z + w*x);         r[8] = w*w - x*x - y*y + z*z;
+}
+
+/*!
+	Replaces the rotation in m by the nearest rotation with rational
+	entries, if one with small enough numbers is within rotation_tolerance.
+	Every integer quaternion q gives such a rotation (the Cayley/Euler-Rodrigues
+	construction), with all entries sharing the denominator |q|^2, so
+	rotated coordinates only grow by that one factor. The quaternion of m
+	is scaled by increasing powers of two and rounded until it fits.
+*/
+void TransformNode::rationalize_rotation()
+{
+	if (rotation_tolerance <= 0)
+		return;
+
+	double q[4];
+	double trace = m[0] + m[5] + m[10];
+	if (trace > 0) {
+		double s = sqrt(trace + 1) * 2;
+		q[0] = s / 4, q[1] = (m[6] - m[9]) / s, q[2] = (m[8] - m[2]) / s, q[3] = (m[1] - m[4]) / s;
+	} else if (m[0] > m[5] && m[0] > m[10]) {
+		double s = sqrt(1 + m[0] - m[5] - m[10]) * 2;
+		q[0] = (m[6] - m[9]) / s, q[1] = s / 4, q[2] = (m[4] + m[1]) / s, q[3] = (m[8] + m[2]) / s;
+	} else if (m[5] > m[10]) {
+		double s = sqrt(1 + m[5] - m[0] - m[10]) * 2;
+		q[0] = (m[8] - m[2]) / s, q[1] = (m[4] + m[1]) / s, q[2] = s / 4, q[3] = (m[9] + m[6]) / s;
+	} else {
+		double s = sqrt(1 + m[10] - m[0] - m[5]) * 2;
+		q[0] = (m[1] - m[4]) / s, q[1] = (m[8] + m[2]) / s, q[2] = (m[9] + m[6]) / s, q[3] = s / 4;
+	}
+
+	// Keep |q|^2 and the matrix entries below 2^53, where doubles are exact
+	for (double scale = 1; scale <= (1 << 24); scale *= 2) {
+		double iq[4], r[9];
+		for (int i = 0; i < 4; i++)
+			iq[i] = floor(q[i] * scale + 0.5);
+		double n = iq[0]*iq[0] + iq[1]*iq[1] + iq[2]*iq[2] + iq[3]*iq[3];
+		if (n == 0)
+			continue;
+		quaternion_to_matrix(iq, r);
+		double err = 0;
+		for (int i = 0; i < 9; i++)
+			err = std::max(err, fabs(r[i] / n - m[(i/3)*4 + i%3]));
+		if (err > rotation_tolerance)
+			continue;
+		for (int i = 0; i < 9; i++)
+			m[(i/3)*4 + i%3] = r[i] / n;
+		for (int i = 0; i < 4; i++)
+			rational_q[i] = iq[i];
+		return;
+	}
 }
 
 TransformScaleNode::TransformScaleNode(const Float3 &scale, const NodeList &children, const Props p) 
@@ -82,6 +152,7 @@ TransformRotateNode::TransformRotateNode(const Float3 &rotation, const NodeList
 	  for (int i = 0; i < 16; i++)
 		  m[i] = mt[i];
   }
+  rationalize_rotation();
 }
 
 TransformRotateAxisNode::TransformRotateAxisNode(const Float3 &axis, FloatType angle, const NodeList &children, const Props p) 
@@ -104,6 +175,7 @@ TransformRotateAxisNode::TransformRotateAxisNode(const Float3 &axis, FloatType a
       m[ 8] = x*z*(1-c)+y*s;
       m[ 9] = y*z*(1-c)-x*s;
       m[10] = z*z*(1-c)+c;
+      rationalize_rotation();
   }
 }
 
@@ -144,8 +216,253 @@ TransformColorNode::TransformColorNode(const Float4 &color, const NodeList &chil
     m[16+i] = color[i];
 }
 
+/*!
+	True if m only moves its children (a color doesn't count).
+*/
+bool TransformNode::is_translation() const
+{
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 3; j++)
+			if (m[i + j*4] != (i == j ? 1 : 0))
+				return false;
+	return m[15] == 1 && rational_q[0] == 0 && rational_q[1] == 0 &&
+			rational_q[2] == 0 && rational_q[3] == 0;
+}
+
+/*!
+	True if m may be applied to vertices in double precision: its bottom
+	row is [0 0 0 1] and no exact rotation replaces its upper 3x3 part.
+*/
+bool TransformNode::is_affine() const
+{
+	return m[3] == 0 && m[7] == 0 && m[11] == 0 && m[15] == 1 &&
+			rational_q[0] == 0 && rational_q[1] == 0 && rational_q[2] == 0 && rational_q[3] == 0;
+}
+
 #ifdef ENABLE_CGAL
 
+struct transformed_leaf_t {
+	const AbstractPolyNode *node;
+	double m[16];
+};
+
+/*!
+	Walks down a chain of transformations and collects the leaves below
+	it, each with the product of all matrices on the way. Returns false if
+	anything other than an affine transformation or a primitive-like node
+	is found.
+*/
+static bool collect_transformed_leaves(const AbstractNode *node, const double *m, std::vector<transformed_leaf_t> &leaves)
+{
+	foreach (AbstractNode::Pointer v, node->children) {
+		if (v->props.background)
+			continue;
+		if (const TransformNode *tn = dynamic_cast<const TransformNode*>(v.get())) {
+			if (!tn->is_affine())
+				return false;
+			double mt[16];
+			for (int i = 0; i < 16; i++) {
+				mt[i] = 0;
+				for (int k = 0; k < 4; k++)
+					mt[i] += m[i%4 + k*4] * tn->m[k + (i/4)*4];
+			}
+			if (!collect_transformed_leaves(tn, mt, leaves))
+				return false;
+		} else if (const AbstractPolyNode *pn = dynamic_cast<const AbstractPolyNode*>(v.get())) {
+			transformed_leaf_t leaf;
+			leaf.node = pn;
+			for (int i = 0; i < 16; i++)
+				leaf.m[i] = m[i];
+			leaves.push_back(leaf);
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*!
+	Renders a chain of transformations over 3D primitives by moving the
+	vertices in double precision and building the Nef polyhedra from the
+	result. This avoids an exact transformation of the whole Nef structure
+	for each level. Returns false if the subtree doesn't qualify, e.g.
+	because it contains booleans or 2D objects.
+*/
+static bool render_cgal_nef_from_leaves(const TransformNode *node, CGAL_Nef_polyhedron &N)
+{
+	std::vector<transformed_leaf_t> leaves;
+	if (!node->is_affine())
+		return false;
+	if (!collect_transformed_leaves(node, node->m.data(), leaves) || leaves.empty())
+		return false;
+
+	std::vector<PolySet*> polysets;
+	bool is3d = true;
+	try {
+		for (size_t i = 0; is3d && i < leaves.size(); i++) {
+			PolySet *ps = leaves[i].node->render_cached_polyset();
+			// Leaves without a PolySet are left to the usual path
+			if (!ps) {
+				is3d = false;
+				continue;
+			}
+			polysets.push_back(ps);
+			is3d = !ps->is2d;
+		}
+
+		bool first = true;
+		for (size_t i = 0; is3d && i < leaves.size(); i++) {
+			const double *m = leaves[i].m;
+			double det = m[0]*(m[5]*m[10] - m[9]*m[6]) - m[4]*(m[1]*m[10] - m[9]*m[2]) + m[8]*(m[1]*m[6] - m[5]*m[2]);
+			const PolySet *src = polysets[i];
+			PolySet *ps = new PolySet();
+			ps->convexity = src->convexity;
+			for (int j = 0; j < src->polygons.size(); j++) {
+				const PolySet::Polygon &poly = src->polygons[j];
+				ps->append_poly();
+				for (int k = 0; k < poly.size(); k++) {
+					// Mirroring turns the faces inside out unless the order is reversed
+					const PolySet::Point &p = poly[det < 0 ? poly.size() - 1 - k : k];
+					ps->append_vertex(m[0]*p.x + m[4]*p.y + m[ 8]*p.z + m[12],
+							m[1]*p.x + m[5]*p.y + m[ 9]*p.z + m[13],
+							m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14]);
+				}
+			}
+			CGAL_Nef_polyhedron leaf_N;
+			try {
+				leaf_N = ps->render_cgal_nef_polyhedron();
+			}
+			catch (...) {
+				ps->unlink();
+				throw;
+			}
+			ps->unlink();
+			if (first) {
+				N = leaf_N;
+				if (N.dim != 0)
+					first = false;
+			} else {
+				N += leaf_N;
+			}
+			leaves[i].node->progress_report();
+		}
+	}
+	catch (...) { // Don't leak the leaf PolySets on ProgressCancelException
+		for (size_t i = 0; i < polysets.size(); i++)
+			polysets[i]->unlink();
+		throw;
+	}
+
+	for (size_t i = 0; i < polysets.size(); i++)
+		polysets[i]->unlink();
+	return is3d;
+}
+
+static void translate_nef(CGAL_Nef_polyhedron &N, const CGAL::Gmpq *t)
+{
+	if (t[0] == 0 && t[1] == 0 && t[2] == 0)
+		return;
+	CGAL_Aff_transformation a(
+			1, 0, 0, t[0],
+			0, 1, 0, t[1],
+			0, 0, 1, t[2], 1);
+	N.edit3().transform(a);
+}
+
+/*!
+	Renders a boolean operation whose operands are all translated objects
+	in the frame of its first operand. The local result is cached by the
+	relative placement of the operands and then moved into place, so the
+	same assembly placed at many positions is computed only once. Returns
+	false if the operands don't qualify, e.g. because one of them isn't a
+	translation or they aren't 3D.
+*/
+bool TransformNode::render_cgal_nef_translated(const AbstractNode *node, csg_type_e type, CGAL_Nef_polyhedron &N)
+{
+	QVector<const TransformNode*> operands;
+	foreach (AbstractNode::Pointer v, node->children) {
+		if (v->props.background)
+			continue;
+		const TransformNode *tn = dynamic_cast<const TransformNode*>(v.get());
+		if (!tn || !tn->is_translation())
+			return false;
+		operands.append(tn);
+	}
+	if (operands.size() < 2)
+		return false;
+
+	// The offsets are exact, so the local result moved by t0 ends up exactly
+	// where rendering the operands in place would put it.
+	CGAL::Gmpq t0[3];
+	for (int j = 0; j < 3; j++)
+		t0[j] = cgal_quantize(operands[0]->m[12 + j]);
+	QVector<CGAL::Gmpq> offsets(operands.size() * 3);
+	std::ostringstream key;
+	key << "local" << type << ":";
+	for (int i = 0; i < operands.size(); i++) {
+		CGAL::Gmpq *t = offsets.data() + i * 3;
+		for (int j = 0; j < 3; j++)
+			t[j] = cgal_quantize(operands[i]->m[12 + j]) - t0[j];
+		key << "[" << t[0] << "," << t[1] << "," << t[2] << "]";
+		foreach (AbstractNode::Pointer v, operands[i]->children) {
+			if (!v->props.background)
+				key << "{" << v->mk_cache_id().toStdString() << "}";
+		}
+	}
+	QString cache_key = QString::fromStdString(key.str());
+
+	CGAL_Nef_polyhedron local;
+	if (cgal_nef_cache.contains(cache_key)) {
+		PRINT(cgal_nef_cache[cache_key]->msg);
+		local = cgal_nef_cache[cache_key]->N;
+	} else {
+		print_messages_push();
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		bool ok = true;
+		try {
+			for (int i = 0; ok && i < operands.size(); i++) {
+				CGAL_Nef_polyhedron operand = CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3());
+				foreach (AbstractNode::Pointer v, operands[i]->children) {
+					if (v->props.background)
+						continue;
+					CGAL_Nef_polyhedron tmp = v->render_cgal_nef_polyhedron();
+					ok = ok && tmp.dim == 3;
+					if (ok)
+						operand += tmp;
+					v->progress_report();
+				}
+				if (!ok)
+					break;
+				translate_nef(operand, offsets.constData() + i * 3);
+				if (i == 0)
+					local = operand;
+				else if (type == CSG_TYPE_UNION)
+					local += operand;
+				else if (type == CSG_TYPE_DIFFERENCE)
+					local -= operand;
+				else if (type == CSG_TYPE_INTERSECTION)
+					local *= operand;
+				operands[i]->progress_report();
+			}
+			if (ok) {
+				local = snap_cgal_nef_polyhedron(local);
+				cgal_nef_cache.insert(cache_key, new cgal_nef_cache_entry(local), local.weight());
+			}
+		}
+		catch (CGAL::Assertion_exception e) {
+			ok = false;
+		}
+		CGAL::set_error_behaviour(old_behaviour);
+		print_messages_pop();
+		if (!ok)
+			return false;
+	}
+
+	N = local;
+	translate_nef(N, t0);
+	return true;
+}
+
 CGAL_Nef_polyhedron TransformNode::render_cgal_nef_polyhedron() const
 {
 	QString cache_id = mk_cache_id();
@@ -157,9 +474,15 @@ CGAL_Nef_polyhedron TransformNode::render_cgal_nef_polyhedron() const
 
 	print_messages_push();
 
-	bool first = true;
 	CGAL_Nef_polyhedron N;
+	if (render_cgal_nef_from_leaves(this, N)) {
+		cgal_nef_cache.insert(cache_id, new cgal_nef_cache_entry(N), N.weight());
+		print_messages_pop();
+		progress_report();
+		return N;
+	}
 
+	bool first = true;
 	foreach (AbstractNode::Pointer v, children) {
 		if (v->props.background)
 			continue;
@@ -167,10 +490,8 @@ CGAL_Nef_polyhedron TransformNode::render_cgal_nef_polyhedron() const
 			N = v->render_cgal_nef_polyhedron();
 			if (N.dim != 0)
 				first = false;
-		} else if (N.dim == 2) {
-			N.p2 += v->render_cgal_nef_polyhedron().p2;
-		} else if (N.dim == 3) {
-			N.p3 += v->render_cgal_nef_polyhedron().p3;
+		} else {
+			N += v->render_cgal_nef_polyhedron();
 		}
 		v->progress_report();
 	}
@@ -186,7 +507,7 @@ CGAL_Nef_polyhedron TransformNode::render_cgal_nef_polyhedron() const
 				m[1], m[5], m[13], m[15]);
 
 		DxfData dd(N);
-		for (int i=0; i < dd.points.size(); i++) {
+		for (size_t i=0; i < dd.points.size(); i++) {
 			CGAL_Kernel2::Point_2 p = CGAL_Kernel2::Point_2(dd.points[i].x, dd.points[i].y);
 			p = t.transform(p);
 			dd.points[i].x = to_double(p.x());
@@ -201,11 +522,25 @@ CGAL_Nef_polyhedron TransformNode::render_cgal_nef_polyhedron() const
 		ps.refcount = 0;
 	}
 	if (N.dim == 3) {
+		// With quantization enabled the matrix is snapped as well, so the
+		// transformed coordinates stay short fractions.
 		CGAL_Aff_transformation t(
-				m[0], m[4], m[ 8], m[12],
-				m[1], m[5], m[ 9], m[13],
-				m[2], m[6], m[10], m[14], m[15]);
-		N.p3.transform(t);
+				cgal_quantize(m[0]), cgal_quantize(m[4]), cgal_quantize(m[ 8]), cgal_quantize(m[12]),
+				cgal_quantize(m[1]), cgal_quantize(m[5]), cgal_quantize(m[ 9]), cgal_quantize(m[13]),
+				cgal_quantize(m[2]), cgal_quantize(m[6]), cgal_quantize(m[10]), cgal_quantize(m[14]), m[15]);
+		if (rational_q[0] != 0 || rational_q[1] != 0 || rational_q[2] != 0 || rational_q[3] != 0) {
+			// Integer entries over the common denominator |q|^2
+			double r[9];
+			quaternion_to_matrix(rational_q, r);
+			CGAL::Gmpq n = rational_q[0]*rational_q[0] + rational_q[1]*rational_q[1] +
+					rational_q[2]*rational_q[2] + rational_q[3]*rational_q[3];
+			t = CGAL_Aff_transformation(
+					r[0], r[3], r[6], cgal_quantize(m[12]) * n,
+					r[1], r[4], r[7], cgal_quantize(m[13]) * n,
+					r[2], r[5], r[8], cgal_quantize(m[14]) * n, n);
+		}
+		N.edit3().transform(t);
+		N = snap_cgal_nef_polyhedron(N);
 	}
 
 	cgal_nef_cache.insert(cache_id, new cgal_nef_cache_entry(N), N.weight());
@@ -252,24 +587,18 @@ CSGTerm *TransformNode::render_csg_term(const Float20 &c, QVector<CSGTerm*> *hig
 	return t1;
 }
 
-QString TransformNode::dump(QString indent) const
+void TransformNode::dump_statement(QTextStream &out) const
 {
-	if (dump_cache.isEmpty()) {
-		QString text;
-		if (m[16] >= 0 || m[17] >= 0 || m[18] >= 0 || m[19] >= 0)
-			text.sprintf("n%d: color([%g, %g, %g, %g])", idx,
-					m[16], m[17], m[18], m[19]);
-		else
-			text.sprintf("n%d: multmatrix([[%g, %g, %g, %g], [%g, %g, %g, %g], "
-					"[%g, %g, %g, %g], [%g, %g, %g, %g]])", idx,
-					m[0], m[4], m[ 8], m[12],
-					m[1], m[5], m[ 9], m[13],
-					m[2], m[6], m[10], m[14],
-					m[3], m[7], m[11], m[15]);
-		text = indent + text + " {\n";
-		foreach (AbstractNode::Pointer v, children)
-			text += v->dump(indent + QString("\t"));
-		((AbstractNode*)this)->dump_cache = text + indent + "}\n";
-	}
-	return dump_cache;
+	QString text;
+	if (m[16] >= 0 || m[17] >= 0 || m[18] >= 0 || m[19] >= 0)
+		text.sprintf("color([%g, %g, %g, %g])",
+				m[16], m[17], m[18], m[19]);
+	else
+		text.sprintf("multmatrix([[%g, %g, %g, %g], [%g, %g, %g, %g], "
+				"[%g, %g, %g, %g], [%g, %g, %g, %g]])",
+				m[0], m[4], m[ 8], m[12],
+				m[1], m[5], m[ 9], m[13],
+				m[2], m[6], m[10], m[14],
+				m[3], m[7], m[11], m[15]);
+	out << text;
 }
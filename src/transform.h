@@ -28,6 +28,7 @@
  */
 
 #include "node.h"
+#include "csgops.h"
 #include "matrix.h"
 #ifdef ENABLE_CGAL
 #  include "cgal.h"
@@ -49,12 +50,23 @@ class TransformNode : public AbstractNode
 public:
 	typedef shared_ptr< TransformNode > Pointer;
 	Float20 m;
+	// Integer quaternion (w, x, y, z) whose rotation replaces the upper
+	// 3x3 part of m in exact arithmetic, or all zero if there is none.
+	double rational_q[4];
+	// Max. deviation of a rotation matrix entry allowed when replacing it
+	// by an exact rational rotation, or 0 to keep rotations unchanged.
+	static double rotation_tolerance;
 	TransformNode(const NodeList &children, const Props p=Props());
+	bool is_translation() const;
+	bool is_affine() const;
 #ifdef ENABLE_CGAL
 	virtual CGAL_Nef_polyhedron render_cgal_nef_polyhedron() const;
+	static bool render_cgal_nef_translated(const AbstractNode *node, csg_type_e type, CGAL_Nef_polyhedron &N);
 #endif
 	virtual CSGTerm *render_csg_term(const Float20 &c, QVector<CSGTerm*> *highlights, QVector<CSGTerm*> *background) const;
-	virtual QString dump(QString indent) const;
+	virtual void dump_statement(QTextStream &out) const;
+protected:
+	void rationalize_rotation();
 };
 
 class TransformScaleNode : public TransformNode {